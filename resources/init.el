@@ -33,13 +33,3 @@
       if (== n 0)
         {first l}
         {nth (dec n) (tail l)}})
-
-;; Checks if element S is contained in list L.
-(defn {contains? s l} {
-      if (== 0 (len l))
-        {false}
-        {
-          if (== s (first l))
-          {true}
-          {contains? s (tail l)}
-        }})
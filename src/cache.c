@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "eval.h"
+#include "image.h"
+
+static uint64_t cache_hash(const char* source, size_t length, int reader) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned char key[2] = { CACHE_VERSION, (unsigned char) reader };
+    for (int i=0; i < 2; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ULL;
+    }
+    for (size_t i=0; i < length; i++) {
+        h ^= (unsigned char) source[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Creates DIR and its missing parents. */
+static bool cache_mkdirs(char* dir) {
+    for (char* p=dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        bool ok = mkdir(dir, 0755) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok) return false;
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+/* Returns the malloced path of the entry for SOURCE, or NULL when there is no cache directory. */
+static char* cache_path(const char* source, size_t length, int reader, bool create) {
+    char dir[4096];
+    const char* env = getenv("MLISP_CACHE_DIR");
+    const char* home = getenv("HOME");
+    if (env && *env) snprintf(dir, sizeof(dir), "%s", env);
+    else if (home && *home) snprintf(dir, sizeof(dir), "%s/.cache/mlisp", home);
+    else return NULL;
+
+    if (create && !cache_mkdirs(dir)) return NULL;
+
+    char* path = malloc(strlen(dir) + 32);
+    sprintf(path, "%s/%016llx%s", dir, (unsigned long long) cache_hash(source, length, reader), CACHE_EXTENSION);
+    return path;
+}
+
+/* Returns the forms cached for SOURCE as read by READER, or NULL on a miss. */
+lval* cache_lookup(const char* source, size_t length, int reader) {
+    char* path = cache_path(source, length, reader, false);
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    image_cursor c = {data, (const unsigned char*) data + st.st_size, NULL, false};
+    lval* forms = NULL;
+    /* The header repeats the key, with the source length as a guard against hash collisions. */
+    if (image_get_header(&c) && image_get_uint(&c) == CACHE_VERSION
+        && image_get_uint(&c) == (uint64_t) reader && image_get_uint(&c) == length) {
+        forms = image_get_lval(&c);
+    }
+
+    if (forms && (c.failed || forms->type != LVAL_QEXPR)) {
+        lval_del(forms);
+        forms = NULL;
+    }
+    munmap(data, st.st_size);
+    return forms;
+}
+
+/* Writes FORMS as the entry for SOURCE. Failures are ignored: the cache is only an optimisation. */
+void cache_store(const char* source, size_t length, int reader, lval* forms) {
+    char* path = cache_path(source, length, reader, true);
+    if (!path) return;
+
+    image_buf b = {NULL, 0, 0};
+    image_put_header(&b);
+    image_put_uint(&b, CACHE_VERSION);
+    image_put_uint(&b, (uint64_t) reader);
+    image_put_uint(&b, length);
+    image_put_lval(&b, NULL, forms);
+
+    /* Written under a temporary name and renamed, so concurrent runs never see a partial entry. */
+    char* tmp = malloc(strlen(path) + 32);
+    sprintf(tmp, "%s.%ld.tmp", path, (long) getpid());
+    FILE* fp = fopen(tmp, "wb");
+    if (fp) {
+        bool ok = fwrite(b.data, 1, b.length, fp) == b.length;
+        if (fclose(fp) != 0) ok = false;
+        if (!ok || rename(tmp, path) != 0) remove(tmp);
+    }
+
+    free(tmp);
+    free(path);
+    free(b.data);
+}
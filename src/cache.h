@@ -0,0 +1,24 @@
+#ifndef MLISP_CACHE_H
+#define MLISP_CACHE_H
+
+#include <stddef.h>
+
+#include "eval.h"
+
+/*
+ * On-disk cache of read source files, used only with --cache. An entry is
+ * a .mlc file named after the hash of the source text, CACHE_VERSION and
+ * the reader that read it, and holds its forms in the image encoding. So
+ * editing a file or switching readers changes the name, and stale entries
+ * are never read. Entries live in $MLISP_CACHE_DIR, or ~/.cache/mlisp.
+ */
+
+#define CACHE_EXTENSION ".mlc"
+
+/* Bump whenever the readers, the chunking of files or the image encoding change what an entry holds. */
+#define CACHE_VERSION 4
+
+lval* cache_lookup(const char* source, size_t length, int reader);
+void cache_store(const char* source, size_t length, int reader, lval* forms);
+
+#endif
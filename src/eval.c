@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "mpc.h"
 #include "eval.h"
+#include "hamt.h"
+#include "lseq.h"
+#include "output.h"
+#include "sort.h"
+#include "xform.h"
 
 char* ltype_name (int t) {
     switch (t) {
@@ -25,6 +31,14 @@ char* ltype_name (int t) {
             return "Q-Expression";
         case LVAL_BOOLEAN:
             return "Boolean";
+        case LVAL_SEQ:
+            return "Lazy-Sequence";
+        case LVAL_XFORM:
+            return "Transducer";
+        case LVAL_MAP:
+            return "Map";
+        case LVAL_SET:
+            return "Set";
         default:
             return "Unknown";
     }
@@ -102,6 +116,34 @@ lval* lval_err(char* fmt, ...) {
     return v;
 }
 
+lval* lval_seq(lseq* s) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SEQ;
+    v->seq = s;
+    return v;
+}
+
+lval* lval_xform(lxform* xf) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_XFORM;
+    v->xform = xf;
+    return v;
+}
+
+lval* lval_map(hamt* m) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_MAP;
+    v->map = m;
+    return v;
+}
+
+lval* lval_set(hamt* m) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SET;
+    v->map = m;
+    return v;
+}
+
 lval* lval_sexpr(void) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_SEXPR;
@@ -137,6 +179,13 @@ int lval_eq(lval* x, lval* y) {
             else return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
         case LVAL_BOOLEAN:
             return x->integer == y->integer;
+        case LVAL_SEQ:
+            return x->seq == y->seq;
+        case LVAL_XFORM:
+            return x->xform == y->xform;
+        case LVAL_MAP:
+        case LVAL_SET:
+            return hamt_eq(x->map, y->map);
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             if (x->count != y->count) return 0;
@@ -149,6 +198,73 @@ int lval_eq(lval* x, lval* y) {
     return 0;
 }
 
+static uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_str(char* s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Structural hash that agrees with lval_eq: equal values hash equally. */
+uint64_t lval_hash(lval* v) {
+    uint64_t h = (uint64_t) v->type * 0x9e3779b97f4a7c15ULL;
+
+    switch (v->type) {
+        case LVAL_INTEGER:
+        case LVAL_BOOLEAN:
+            h ^= (uint64_t) v->integer;
+            break;
+        case LVAL_REAL: {
+            double d = v->real == 0 ? 0.0 : v->real;
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            h ^= bits;
+            break;
+        }
+        case LVAL_ERR:
+            h ^= hash_str(v->err);
+            break;
+        case LVAL_SYM:
+            h ^= hash_str(v->sym);
+            break;
+        case LVAL_STR:
+            h ^= hash_str(v->str);
+            break;
+        case LVAL_FUN:
+            if (v->builtin) h ^= (uint64_t) (uintptr_t) v->builtin;
+            else h ^= lval_hash(v->formals) * 31 + lval_hash(v->body);
+            break;
+        case LVAL_SEQ:
+            h ^= (uint64_t) (uintptr_t) v->seq;
+            break;
+        case LVAL_XFORM:
+            h ^= (uint64_t) (uintptr_t) v->xform;
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            h ^= hamt_hash(v->map);
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (int i=0; i < v->count; i++) {
+                h = h * 31 + lval_hash(v->cell[i]);
+            }
+            break;
+    }
+    return hash_mix(h);
+}
+
 void lval_del(lval* v) {
     switch (v->type) {
         case LVAL_INTEGER:
@@ -166,6 +282,16 @@ void lval_del(lval* v) {
         case LVAL_STR:
             free(v->str);
             break;
+        case LVAL_SEQ:
+            lseq_unref(v->seq);
+            break;
+        case LVAL_XFORM:
+            xform_unref(v->xform);
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            hamt_unref(v->map);
+            break;
         case LVAL_FUN:
             if (!v->builtin) {
                 lenv_del(v->env);
@@ -191,9 +317,8 @@ lval* lval_read_integer(mpc_ast_t* ast) {
 }
 
 lval* lval_read_real(mpc_ast_t* ast) {
-    errno = 0;
     double value = strtod(ast->contents, NULL);
-    return errno != ERANGE ? lval_real(value) : lval_err("Bad real");
+    return fabs(value) != HUGE_VAL ? lval_real(value) : lval_err("Bad real");
 }
 
 lval* lval_read_boolean(mpc_ast_t* ast) {
@@ -255,6 +380,16 @@ lval* lval_copy(lval* v) {
             x->str = malloc(strlen(v->str) + 1);
             strcpy(x->str, v->str);
             break;
+        case LVAL_SEQ:
+            x->seq = lseq_ref(v->seq);
+            break;
+        case LVAL_XFORM:
+            x->xform = xform_ref(v->xform);
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            x->map = hamt_ref(v->map);
+            break;
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
@@ -268,41 +403,74 @@ lval* lval_copy(lval* v) {
     return x;
 }
 
-lval* lval_read(mpc_ast_t* ast) {
-    if (strstr(ast->tag, "integer")) {
-        return lval_read_integer(ast);
-    } else if (strstr(ast->tag, "real")) {
-        return lval_read_real(ast);
-    } else if (strstr(ast->tag, "bool")) {
-        return lval_read_boolean(ast);
-    } else if (strstr(ast->tag, "symbol")) {
-        return lval_sym(ast->contents);
-    } else if (strstr(ast->tag, "string")) {
-        return lval_read_str(ast);
-    }
-
+/* What lval_read makes of a node, decided from its tag. */
+typedef enum {
+    READ_INTEGER, READ_REAL, READ_BOOLEAN, READ_SYMBOL, READ_STRING,
+    READ_SEXPR, READ_QEXPR, READ_NONE
+} read_kind;
+
+typedef struct {
+    const char* tag;
+    read_kind kind;
+    bool skip;
+} read_tag;
+
+enum { READ_TAGS = 64 };
+
+/*
+ * Trees from mpca_lang grammars intern their tags, so equal tags are the
+ * same pointer and a small cache keyed on it classifies each distinct tag
+ * once per read. A collision just classifies the tag again.
+ */
+static read_tag* read_classify(read_tag* cache, const char* tag) {
+    read_tag* t = &cache[((uintptr_t) tag / sizeof(void*)) % READ_TAGS];
+    if (t->tag == tag) return t;
+
+    t->tag = tag;
+    t->skip = strcmp(tag, "regex") == 0 || strstr(tag, "comment");
+    if (strstr(tag, "integer")) t->kind = READ_INTEGER;
+    else if (strstr(tag, "real")) t->kind = READ_REAL;
+    else if (strstr(tag, "bool")) t->kind = READ_BOOLEAN;
+    else if (strstr(tag, "symbol")) t->kind = READ_SYMBOL;
+    else if (strstr(tag, "string")) t->kind = READ_STRING;
+    else if (strstr(tag, "qexpr")) t->kind = READ_QEXPR;
+    else if (strstr(tag, "sexpr") || strcmp(tag, ">") == 0) t->kind = READ_SEXPR;
+    else t->kind = READ_NONE;
+    return t;
+}
+
+static bool read_is_bracket(const char* contents) {
+    return (contents[0] == '(' || contents[0] == ')' || contents[0] == '{' || contents[0] == '}')
+        && contents[1] == '\0';
+}
+
+static lval* lval_read_ast(mpc_ast_t* ast, read_tag* cache) {
     lval* x = NULL;
-    if (strcmp(ast->tag, ">") == 0) {
-        x = lval_sexpr();
-    }
-    if (strstr(ast->tag, "sexpr")) {
-        x = lval_sexpr();
-    }
-    if (strstr(ast->tag, "qexpr")) {
-        x = lval_qexpr();
+    switch (read_classify(cache, ast->tag)->kind) {
+        case READ_INTEGER: return lval_read_integer(ast);
+        case READ_REAL: return lval_read_real(ast);
+        case READ_BOOLEAN: return lval_read_boolean(ast);
+        case READ_SYMBOL: return lval_sym(ast->contents);
+        case READ_STRING: return lval_read_str(ast);
+        case READ_SEXPR: x = lval_sexpr(); break;
+        case READ_QEXPR: x = lval_qexpr(); break;
+        case READ_NONE: break;
     }
 
     for (int i=0; i < ast->children_num; i++) {
-        if (strcmp(ast->children[i]->contents, "(") == 0) continue;
-        if (strcmp(ast->children[i]->contents, ")") == 0) continue;
-        if (strcmp(ast->children[i]->contents, "{") == 0) continue;
-        if (strcmp(ast->children[i]->contents, "}") == 0) continue;
-        if (strcmp(ast->children[i]->tag, "regex") == 0) continue;
-        x = lval_add(x, lval_read(ast->children[i]));
+        mpc_ast_t* child = ast->children[i];
+        if (read_is_bracket(child->contents)) continue;
+        if (read_classify(cache, child->tag)->skip) continue;
+        x = lval_add(x, lval_read_ast(child, cache));
     }
     return x;
 }
 
+lval* lval_read(mpc_ast_t* ast) {
+    read_tag cache[READ_TAGS] = {{0}};
+    return lval_read_ast(ast, cache);
+}
+
 lval* lval_pop(lval* v, int i) {
     lval* x = v->cell[i];
     memmove(&v->cell[i],
@@ -603,6 +771,8 @@ bool to_bool(lval* v) {
             return v->integer != 0;
         case LVAL_REAL:
             return v->real != 0;
+        case LVAL_BOOLEAN:
+            return v->integer != 0;
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             return v->count != 0;
@@ -669,10 +839,17 @@ lval* builtin_print(lenv* e, lval* a, int level) {
 
 lval* builtin_println(lenv* e, lval* a, int level) {
     lval* rv = builtin_print(e, a, level);
-    putchar('\n');
+    output_char('\n');
     return rv;
 }
 
+lval* builtin_flush(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("flush", a, 0);
+    output_flush();
+    lval_del(a);
+    return lval_sexpr();
+}
+
 lval* builtin_error(lenv* e, lval* a, int level) {
     LASSERT_NUM_ARGUMENTS("error", a, 1);
     LASSERT_TYPE("error", a, a->cell[0]->type, LVAL_STR);
@@ -727,6 +904,12 @@ lval* builtin_cons(lenv* e, lval* a, int level) {
 lval* builtin_len(lenv* e, lval* a, int level) {
     lval* x = lval_pop(a, 0);
 
+    if (x->type == LVAL_MAP || x->type == LVAL_SET) {
+        long length = x->map->count;
+        lval_del(x);
+        return lval_integer(length);
+    }
+
     LASSERT_TYPE("len", x, x->type, LVAL_QEXPR);
 
     long length = x->count;
@@ -795,7 +978,6 @@ lval* builtin_op(lenv* e, lval* a, char* op, int level) {
         char* error = apply_op_binary(x, op, y);
         if (error) {
             lval_del(x);
-            lval_del(y);
             x = lval_err(error);
         }
         lval_del(y);
@@ -895,6 +1077,664 @@ lval* builtin_stable(lenv* e, lval* a, int level) {
     return table;
 }
 
+/* Consumes the set S and returns its elements as a Q-Expression. */
+lval* lval_set_elements(lval* s) {
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * (s->map->count ? s->map->count : 1));
+
+    hamt_iter it;
+    hamt_iter_init(&it, s->map);
+    hamt_entry* entry;
+    while ((entry = hamt_iter_next(&it))) {
+        x->cell[x->count++] = lval_copy(entry->key);
+    }
+
+    lval_del(s);
+    return x;
+}
+
+lval* builtin_range(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count <= 3,
+            "Function 'range' passed invalid number of arguments. Got %i, expected at most 3",
+            a->count);
+    for (int i=0; i < a->count; i++) {
+        LASSERT_TYPE("range", a, a->cell[i]->type, LVAL_INTEGER);
+    }
+
+    lseq* s;
+    switch (a->count) {
+        case 0:
+            s = lseq_range(0, 0, 1, false);
+            break;
+        case 1:
+            s = lseq_range(0, a->cell[0]->integer, 1, true);
+            break;
+        case 2:
+            s = lseq_range(a->cell[0]->integer, a->cell[1]->integer, 1, true);
+            break;
+        default:
+            LASSERT(a, a->cell[2]->integer != 0, "Function 'range' passed a step of 0.");
+            s = lseq_range(a->cell[0]->integer, a->cell[1]->integer, a->cell[2]->integer, true);
+            break;
+    }
+
+    lval_del(a);
+    return lval_seq(s);
+}
+
+lval* builtin_iterate(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("iterate", a, 2);
+    LASSERT_TYPE("iterate", a, a->cell[0]->type, LVAL_FUN);
+
+    lval* fn = lval_pop(a, 0);
+    lval* seed = lval_take(a, 0);
+    return lval_seq(lseq_iterate(fn, seed));
+}
+
+#define LASSERT_COLL(fname, args, actual_type) \
+    LASSERT(args, actual_type == LVAL_QEXPR || actual_type == LVAL_SEQ, \
+            "Function '%s' passed incorrect type. Got %s, Expected %s or %s.", \
+            fname, ltype_name(actual_type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_SEQ));
+
+lval* builtin_take(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+            "Function 'take' passed invalid number of arguments. Got %i, expected 1 or 2",
+            a->count);
+    LASSERT_TYPE("take", a, a->cell[0]->type, LVAL_INTEGER);
+
+    long n = a->cell[0]->integer;
+    if (a->count == 1) {
+        lval_del(a);
+        return lval_xform(xform_new(XFORM_TAKE, NULL, n));
+    }
+
+    LASSERT_COLL("take", a, a->cell[1]->type);
+    lval* coll = lval_take(a, 1);
+    if (coll->type == LVAL_SEQ) return lval_seq(lseq_take(lseq_of(coll), n));
+
+    int kept = n < 0 ? 0 : (n > coll->count ? coll->count : n);
+    for (int i=kept; i < coll->count; i++) lval_del(coll->cell[i]);
+    coll->count = kept;
+    return coll;
+}
+
+lval* builtin_drop(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+            "Function 'drop' passed invalid number of arguments. Got %i, expected 1 or 2",
+            a->count);
+    LASSERT_TYPE("drop", a, a->cell[0]->type, LVAL_INTEGER);
+
+    long n = a->cell[0]->integer;
+    if (a->count == 1) {
+        lval_del(a);
+        return lval_xform(xform_new(XFORM_DROP, NULL, n));
+    }
+
+    LASSERT_COLL("drop", a, a->cell[1]->type);
+    lval* coll = lval_take(a, 1);
+    if (coll->type == LVAL_SEQ) return lval_seq(lseq_drop(lseq_of(coll), n));
+
+    int dropped = n < 0 ? 0 : (n > coll->count ? coll->count : n);
+    for (int i=0; i < dropped; i++) lval_del(coll->cell[i]);
+    memmove(&coll->cell[0], &coll->cell[dropped], sizeof(lval*) * (coll->count - dropped));
+    coll->count -= dropped;
+    return coll;
+}
+
+lval* builtin_lazy_map(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("lazy-map", a, 2);
+    LASSERT_TYPE("lazy-map", a, a->cell[0]->type, LVAL_FUN);
+    LASSERT_COLL("lazy-map", a, a->cell[1]->type);
+
+    lval* fn = lval_pop(a, 0);
+    return lval_seq(lseq_map(fn, lseq_of(lval_take(a, 0))));
+}
+
+lval* builtin_lazy_filter(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("lazy-filter", a, 2);
+    LASSERT_TYPE("lazy-filter", a, a->cell[0]->type, LVAL_FUN);
+    LASSERT_COLL("lazy-filter", a, a->cell[1]->type);
+
+    lval* fn = lval_pop(a, 0);
+    return lval_seq(lseq_filter(fn, lseq_of(lval_take(a, 0))));
+}
+
+lval* builtin_realize(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("realize", a, 1);
+    if (a->cell[0]->type == LVAL_SET) return lval_set_elements(lval_take(a, 0));
+    LASSERT_COLL("realize", a, a->cell[0]->type);
+
+    lval* coll = lval_take(a, 0);
+    if (coll->type == LVAL_QEXPR) return coll;
+
+    lval* list = lseq_realize(e, coll->seq);
+    lval_del(coll);
+    return list;
+}
+
+lval* builtin_xform_fn(lenv* e, lval* a, char* fname, xform_kind_t kind) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+            "Function '%s' passed invalid number of arguments. Got %i, expected 1 or 2",
+            fname, a->count);
+    LASSERT_TYPE(fname, a, a->cell[0]->type, LVAL_FUN);
+
+    if (a->count == 1) return lval_xform(xform_new(kind, lval_take(a, 0), 0));
+
+    LASSERT_COLL(fname, a, a->cell[1]->type);
+
+    lxform* xf = xform_new(kind, lval_pop(a, 0), 0);
+    lval* result = xform_transduce(e, xf, NULL, lval_qexpr(), lval_take(a, 0));
+    xform_unref(xf);
+    return result;
+}
+
+lval* builtin_map(lenv* e, lval* a, int level) {
+    return builtin_xform_fn(e, a, "map", XFORM_MAP);
+}
+
+lval* builtin_filter(lenv* e, lval* a, int level) {
+    return builtin_xform_fn(e, a, "filter", XFORM_FILTER);
+}
+
+lval* builtin_comp(lenv* e, lval* a, int level) {
+    for (int i=0; i < a->count; i++) {
+        LASSERT_TYPE("comp", a, a->cell[i]->type, LVAL_XFORM);
+    }
+
+    lxform** xfs = malloc(sizeof(lxform*) * (a->count ? a->count : 1));
+    for (int i=0; i < a->count; i++) xfs[i] = a->cell[i]->xform;
+    lxform* xf = xform_comp(xfs, a->count);
+    free(xfs);
+
+    lval_del(a);
+    return lval_xform(xf);
+}
+
+lval* builtin_transduce(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("transduce", a, 4);
+    LASSERT_TYPE("transduce", a, a->cell[0]->type, LVAL_XFORM);
+    LASSERT_TYPE("transduce", a, a->cell[1]->type, LVAL_FUN);
+    LASSERT_COLL("transduce", a, a->cell[3]->type);
+
+    lval* xf = lval_pop(a, 0);
+    lval* rf = lval_pop(a, 0);
+    lval* init = lval_pop(a, 0);
+    lval* result = xform_transduce(e, xf->xform, rf, init, lval_take(a, 0));
+    lval_del(xf);
+    lval_del(rf);
+    return result;
+}
+
+#define LASSERT_MAP(fname, args, v, transient) \
+    LASSERT_TYPE(fname, args, v->type, LVAL_MAP); \
+    LASSERT(args, !v->map->edit == !(transient), \
+            "Function '%s' passed a %s map.", fname, v->map->edit ? "transient" : "persistent");
+
+#define LASSERT_PAIRS(fname, args, offset) \
+    LASSERT(args, (args->count - offset) % 2 == 0, \
+            "Function '%s' passed a key without a value.", fname);
+
+/* Moves the key/value pairs of A starting at I into the transient T. */
+void hamt_assoc_cells(hamt* t, lval* a, int i) {
+    for (; i + 1 < a->count; i += 2) {
+        hamt_assoc_mut(t, a->cell[i], a->cell[i + 1]);
+        a->cell[i] = NULL;
+        a->cell[i + 1] = NULL;
+    }
+}
+
+void hamt_dissoc_cells(hamt* t, lval* a, int i) {
+    for (; i < a->count; i++) hamt_dissoc_mut(t, a->cell[i]);
+}
+
+/* Deletes A after its cells from I onwards were moved out. */
+void lval_del_moved(lval* a, int i) {
+    a->count = i;
+    lval_del(a);
+}
+
+lval* builtin_hash_map(lenv* e, lval* a, int level) {
+    LASSERT_PAIRS("hash-map", a, 0);
+
+    hamt* t = hamt_transient_empty();
+
+    hamt_assoc_cells(t, a, 0);
+    lval_del_moved(a, 0);
+
+    hamt_persistent(t);
+    return lval_map(t);
+}
+
+lval* builtin_assoc(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count >= 1, "Function 'assoc' passed no arguments.");
+    LASSERT_MAP("assoc", a, a->cell[0], false);
+    LASSERT_PAIRS("assoc", a, 1);
+
+    hamt* t = hamt_transient(a->cell[0]->map);
+    hamt_assoc_cells(t, a, 1);
+    lval_del_moved(a, 1);
+
+    hamt_persistent(t);
+    return lval_map(t);
+}
+
+lval* builtin_dissoc(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count >= 1, "Function 'dissoc' passed no arguments.");
+    LASSERT_MAP("dissoc", a, a->cell[0], false);
+
+    hamt* t = hamt_transient(a->cell[0]->map);
+    hamt_dissoc_cells(t, a, 1);
+    lval_del(a);
+
+    hamt_persistent(t);
+    return lval_map(t);
+}
+
+lval* builtin_get(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+            "Function 'get' passed invalid number of arguments. Got %i, expected 2 or 3",
+            a->count);
+    LASSERT_TYPE("get", a, a->cell[0]->type, LVAL_MAP);
+
+    lval* v = hamt_get(a->cell[0]->map, a->cell[1]);
+    lval* x;
+    if (v) x = lval_copy(v);
+    else if (a->count == 3) x = lval_pop(a, 2);
+    else x = lval_qexpr();
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map_entries(lenv* e, lval* a, char* fname, bool keys) {
+    LASSERT_NUM_ARGUMENTS(fname, a, 1);
+    LASSERT_TYPE(fname, a, a->cell[0]->type, LVAL_MAP);
+
+    lval* x = lval_qexpr();
+    hamt_iter it;
+    hamt_iter_init(&it, a->cell[0]->map);
+    hamt_entry* entry;
+    while ((entry = hamt_iter_next(&it))) {
+        lval_add(x, lval_copy(keys ? entry->key : entry->val));
+    }
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_keys(lenv* e, lval* a, int level) {
+    return builtin_map_entries(e, a, "keys", true);
+}
+
+lval* builtin_vals(lenv* e, lval* a, int level) {
+    return builtin_map_entries(e, a, "vals", false);
+}
+
+lval* builtin_merge(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count >= 1, "Function 'merge' passed no arguments.");
+    for (int i=0; i < a->count; i++) {
+        LASSERT_MAP("merge", a, a->cell[i], false);
+    }
+
+    hamt* t = hamt_transient(a->cell[0]->map);
+    for (int i=1; i < a->count; i++) {
+        hamt_iter it;
+        hamt_iter_init(&it, a->cell[i]->map);
+        hamt_entry* entry;
+        while ((entry = hamt_iter_next(&it))) {
+            hamt_assoc_mut(t, lval_copy(entry->key), lval_copy(entry->val));
+        }
+    }
+    lval_del(a);
+
+    hamt_persistent(t);
+    return lval_map(t);
+}
+
+lval* builtin_transient(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("transient", a, 1);
+    LASSERT_MAP("transient", a, a->cell[0], false);
+
+    hamt* t = hamt_transient(a->cell[0]->map);
+    lval_del(a);
+    return lval_map(t);
+}
+
+lval* builtin_assoc_mut(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count >= 1, "Function 'assoc!' passed no arguments.");
+    LASSERT_MAP("assoc!", a, a->cell[0], true);
+    LASSERT_PAIRS("assoc!", a, 1);
+
+    lval* t = lval_pop(a, 0);
+    hamt_assoc_cells(t->map, a, 0);
+    lval_del_moved(a, 0);
+    return t;
+}
+
+lval* builtin_dissoc_mut(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count >= 1, "Function 'dissoc!' passed no arguments.");
+    LASSERT_MAP("dissoc!", a, a->cell[0], true);
+
+    lval* t = lval_pop(a, 0);
+    hamt_dissoc_cells(t->map, a, 0);
+    lval_del(a);
+    return t;
+}
+
+lval* builtin_persistent(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("persistent!", a, 1);
+    LASSERT_MAP("persistent!", a, a->cell[0], true);
+
+    hamt_persistent(a->cell[0]->map);
+    return lval_take(a, 0);
+}
+
+lval* builtin_hash_set(lenv* e, lval* a, int level) {
+    hamt* t = hamt_transient_empty();
+    for (int i=0; i < a->count; i++) {
+        hamt_assoc_mut(t, a->cell[i], NULL);
+    }
+    lval_del_moved(a, 0);
+
+    hamt_persistent(t);
+    return lval_set(t);
+}
+
+lval* builtin_set(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("set", a, 1);
+    if (a->cell[0]->type == LVAL_SET) return lval_take(a, 0);
+    LASSERT_COLL("set", a, a->cell[0]->type);
+
+    lval* coll = lval_take(a, 0);
+    if (coll->type == LVAL_SEQ) {
+        lval* list = lseq_realize(e, coll->seq);
+        lval_del(coll);
+        if (list->type == LVAL_ERR) return list;
+        coll = list;
+    }
+    return builtin_hash_set(e, coll, level);
+}
+
+lval* builtin_contains(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("contains?", a, 2);
+
+    lval* x = a->cell[0];
+    lval* coll = a->cell[1];
+    bool found = false;
+
+    switch (coll->type) {
+        case LVAL_SET:
+        case LVAL_MAP:
+            found = hamt_contains(coll->map, x);
+            break;
+        case LVAL_QEXPR:
+            for (int i=0; i < coll->count && !found; i++) {
+                found = lval_eq(x, coll->cell[i]);
+            }
+            break;
+        case LVAL_SEQ: {
+            lseq_iter* it = lseq_iter_new(e, coll->seq);
+            lval* y;
+            while (!found && (y = lseq_iter_next(it))) {
+                if (y->type == LVAL_ERR) {
+                    lseq_iter_del(it);
+                    lval_del(a);
+                    return y;
+                }
+                found = lval_eq(x, y);
+                lval_del(y);
+            }
+            lseq_iter_del(it);
+            break;
+        }
+        default:
+            LASSERT(a, false, "Function 'contains?' passed incorrect type. Got %s, Expected a collection.",
+                    ltype_name(coll->type));
+    }
+
+    lval_del(a);
+    return lval_boolean(found);
+}
+
+/* Keeps the first occurrence of each element, in order. */
+lval* builtin_distinct(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("distinct", a, 1);
+    if (a->cell[0]->type == LVAL_SET) return lval_set_elements(lval_take(a, 0));
+    LASSERT_COLL("distinct", a, a->cell[0]->type);
+
+    lval* coll = lval_take(a, 0);
+    lseq* s = lseq_of(coll);
+    lseq_iter* it = lseq_iter_new(e, s);
+    lseq_unref(s);
+
+    hamt* seen = hamt_transient_empty();
+    lval* x = lval_qexpr();
+    lval* y;
+    while ((y = lseq_iter_next(it))) {
+        if (y->type == LVAL_ERR) {
+            lval_del(x);
+            x = y;
+            break;
+        }
+        if (hamt_contains(seen, y)) {
+            lval_del(y);
+            continue;
+        }
+        hamt_assoc_mut(seen, lval_copy(y), NULL);
+        lval_add(x, y);
+    }
+
+    lseq_iter_del(it);
+    hamt_unref(seen);
+    return x;
+}
+
+#define LASSERT_SETS(fname, args) \
+    LASSERT(args, args->count >= 1, "Function '%s' passed no arguments.", fname); \
+    for (int i=0; i < args->count; i++) { \
+        LASSERT_TYPE(fname, args, args->cell[i]->type, LVAL_SET); \
+    }
+
+lval* builtin_union(lenv* e, lval* a, int level) {
+    LASSERT_SETS("union", a);
+
+    int largest = 0;
+    for (int i=1; i < a->count; i++) {
+        if (a->cell[i]->map->count > a->cell[largest]->map->count) largest = i;
+    }
+
+    hamt* t = hamt_transient(a->cell[largest]->map);
+    for (int i=0; i < a->count; i++) {
+        if (i == largest) continue;
+
+        hamt_iter it;
+        hamt_iter_init(&it, a->cell[i]->map);
+        hamt_entry* entry;
+        while ((entry = hamt_iter_next(&it))) {
+            if (!hamt_contains(t, entry->key)) hamt_assoc_mut(t, lval_copy(entry->key), NULL);
+        }
+    }
+    lval_del(a);
+
+    hamt_persistent(t);
+    return lval_set(t);
+}
+
+lval* builtin_intersection(lenv* e, lval* a, int level) {
+    LASSERT_SETS("intersection", a);
+
+    int smallest = 0;
+    for (int i=1; i < a->count; i++) {
+        if (a->cell[i]->map->count < a->cell[smallest]->map->count) smallest = i;
+    }
+
+    hamt* t = hamt_transient_empty();
+    hamt_iter it;
+    hamt_iter_init(&it, a->cell[smallest]->map);
+    hamt_entry* entry;
+    while ((entry = hamt_iter_next(&it))) {
+        bool everywhere = true;
+        for (int i=0; i < a->count && everywhere; i++) {
+            if (i != smallest) everywhere = hamt_contains(a->cell[i]->map, entry->key);
+        }
+        if (everywhere) hamt_assoc_mut(t, lval_copy(entry->key), NULL);
+    }
+    lval_del(a);
+
+    hamt_persistent(t);
+    return lval_set(t);
+}
+
+lval* builtin_difference(lenv* e, lval* a, int level) {
+    LASSERT_SETS("difference", a);
+
+    hamt* t = hamt_transient(a->cell[0]->map);
+    for (int i=1; i < a->count; i++) {
+        hamt_iter it;
+        hamt_iter_init(&it, a->cell[i]->map);
+        hamt_entry* entry;
+        while ((entry = hamt_iter_next(&it))) {
+            hamt_dissoc_mut(t, entry->key);
+        }
+    }
+    lval_del(a);
+
+    hamt_persistent(t);
+    return lval_set(t);
+}
+
+/* Consumes COLL and returns its elements as a Q-Expression, or an error. */
+lval* lval_to_list(lenv* e, lval* coll) {
+    if (coll->type == LVAL_SET) return lval_set_elements(coll);
+    if (coll->type != LVAL_SEQ) return coll;
+
+    lval* list = lseq_realize(e, coll->seq);
+    lval_del(coll);
+    return list;
+}
+
+/* Picks the key kind shared by all of KEYS, or returns false if they cannot be ordered together. */
+bool sort_kind_of(lval** keys, long n, sort_kind_t* kind) {
+    bool integers = true, numbers = true, strings = true;
+    for (long i=0; i < n; i++) {
+        int t = keys[i]->type;
+        integers = integers && t == LVAL_INTEGER;
+        numbers = numbers && (t == LVAL_INTEGER || t == LVAL_REAL);
+        strings = strings && t == LVAL_STR;
+    }
+
+    if (integers) *kind = SORT_INTEGER;
+    else if (numbers) *kind = SORT_REAL;
+    else if (strings) *kind = SORT_STRING;
+    return integers || numbers || strings;
+}
+
+/* Sorts the cells of LIST in place by KEYS, which line up with them. */
+void sort_cells_by(lval* list, lval** keys, sort_kind_t kind, bool stable) {
+    sort_item* items = malloc(sizeof(sort_item) * (list->count ? list->count : 1));
+    for (int i=0; i < list->count; i++) {
+        lval* k = keys[i];
+        switch (kind) {
+            case SORT_INTEGER:
+                items[i].key.integer = k->integer;
+                break;
+            case SORT_REAL:
+                items[i].key.real = k->type == LVAL_REAL ? k->real : k->integer;
+                break;
+            case SORT_STRING:
+                items[i].key.str = k->str;
+                break;
+        }
+        items[i].v = list->cell[i];
+    }
+
+    sort_items(items, list->count, kind, stable);
+
+    for (int i=0; i < list->count; i++) list->cell[i] = items[i].v;
+    free(items);
+}
+
+lval* builtin_sort(lenv* e, lval* a, int level) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+            "Function 'sort' passed invalid number of arguments. Got %i, expected 1 or 2",
+            a->count);
+    if (a->count == 2) LASSERT_TYPE("sort", a, a->cell[0]->type, LVAL_FUN);
+
+    lval* coll = a->cell[a->count - 1];
+    LASSERT(a, coll->type == LVAL_QEXPR || coll->type == LVAL_SEQ || coll->type == LVAL_SET,
+            "Function 'sort' passed incorrect type. Got %s, Expected a collection.",
+            ltype_name(coll->type));
+
+    lval* list = lval_to_list(e, lval_pop(a, a->count - 1));
+    if (list->type == LVAL_ERR) {
+        lval_del(a);
+        return list;
+    }
+
+    if (a->count == 1) {
+        lval* err = sort_with(e, a->cell[0], list->cell, list->count);
+        lval_del(a);
+        if (err) {
+            lval_del(list);
+            return err;
+        }
+        return list;
+    }
+    lval_del(a);
+
+    sort_kind_t kind;
+    if (!sort_kind_of(list->cell, list->count, &kind)) {
+        lval_del(list);
+        return lval_err("Function 'sort' can only order numbers or strings without a comparator.");
+    }
+
+    sort_cells_by(list, list->cell, kind, false);
+    return list;
+}
+
+lval* builtin_sort_by(lenv* e, lval* a, int level) {
+    LASSERT_NUM_ARGUMENTS("sort-by", a, 2);
+    LASSERT_TYPE("sort-by", a, a->cell[0]->type, LVAL_FUN);
+    LASSERT(a, a->cell[1]->type == LVAL_QEXPR || a->cell[1]->type == LVAL_SEQ || a->cell[1]->type == LVAL_SET,
+            "Function 'sort-by' passed incorrect type. Got %s, Expected a collection.",
+            ltype_name(a->cell[1]->type));
+
+    lval* keyfn = lval_pop(a, 0);
+    lval* list = lval_to_list(e, lval_take(a, 0));
+    if (list->type == LVAL_ERR) {
+        lval_del(keyfn);
+        return list;
+    }
+
+    lval** keys = malloc(sizeof(lval*) * (list->count ? list->count : 1));
+    int computed = 0;
+    lval* err = NULL;
+    for (; computed < list->count; computed++) {
+        lval* k = lval_apply(e, keyfn, lval_add(lval_sexpr(), lval_copy(list->cell[computed])));
+        if (k->type == LVAL_ERR) {
+            err = k;
+            break;
+        }
+        keys[computed] = k;
+    }
+
+    sort_kind_t kind;
+    if (!err && !sort_kind_of(keys, list->count, &kind)) {
+        err = lval_err("Function 'sort-by' can only order by numbers or strings.");
+    }
+    if (!err) sort_cells_by(list, keys, kind, true);
+
+    for (int i=0; i < computed; i++) lval_del(keys[i]);
+    free(keys);
+    lval_del(keyfn);
+
+    if (err) {
+        lval_del(list);
+        return err;
+    }
+    return list;
+}
+
 lval* lval_take(lval* v, int i) {
     lval* x = lval_pop(v, i);
     lval_del(v);
@@ -966,7 +1806,44 @@ void lenv_add_builtins(lenv* e) {
 
     lenv_add_builtin(e, "print", builtin_print);
     lenv_add_builtin(e, "println", builtin_println);
+    lenv_add_builtin(e, "flush", builtin_flush);
     lenv_add_builtin(e, "error", builtin_error);
+
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "iterate", builtin_iterate);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "lazy-map", builtin_lazy_map);
+    lenv_add_builtin(e, "lazy-filter", builtin_lazy_filter);
+    lenv_add_builtin(e, "realize", builtin_realize);
+
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "comp", builtin_comp);
+    lenv_add_builtin(e, "transduce", builtin_transduce);
+
+    lenv_add_builtin(e, "hash-map", builtin_hash_map);
+    lenv_add_builtin(e, "assoc", builtin_assoc);
+    lenv_add_builtin(e, "dissoc", builtin_dissoc);
+    lenv_add_builtin(e, "get", builtin_get);
+    lenv_add_builtin(e, "keys", builtin_keys);
+    lenv_add_builtin(e, "vals", builtin_vals);
+    lenv_add_builtin(e, "merge", builtin_merge);
+    lenv_add_builtin(e, "transient", builtin_transient);
+    lenv_add_builtin(e, "assoc!", builtin_assoc_mut);
+    lenv_add_builtin(e, "dissoc!", builtin_dissoc_mut);
+    lenv_add_builtin(e, "persistent!", builtin_persistent);
+
+    lenv_add_builtin(e, "hash-set", builtin_hash_set);
+    lenv_add_builtin(e, "set", builtin_set);
+    lenv_add_builtin(e, "contains?", builtin_contains);
+    lenv_add_builtin(e, "distinct", builtin_distinct);
+    lenv_add_builtin(e, "union", builtin_union);
+    lenv_add_builtin(e, "intersection", builtin_intersection);
+    lenv_add_builtin(e, "difference", builtin_difference);
+
+    lenv_add_builtin(e, "sort", builtin_sort);
+    lenv_add_builtin(e, "sort-by", builtin_sort_by);
 }
 
 lval* lval_call(lenv* e, lval* f, lval* a, int level) {
@@ -1031,6 +1908,14 @@ lval* lval_call(lenv* e, lval* f, lval* a, int level) {
     }
 }
 
+/* Calls F with the arguments in A without consuming F. */
+lval* lval_apply(lenv* e, lval* f, lval* a) {
+    lval* fn = lval_copy(f);
+    lval* result = lval_call(e, fn, a, 0);
+    lval_del(fn);
+    return result;
+}
+
 lval* lval_eval_sexpr(lenv* e, lval* v, int level) {
     for (int i=0; i < v->count; i++) {
         v->cell[i] = lval_eval(e, v->cell[i], level + 1);
@@ -1059,56 +1944,78 @@ lval* eval(lenv* e, mpc_ast_t* ast) {
 }
 
 void lval_print_expr(lenv* e, lval* v, char open, char close) {
-    putchar(open);
+    output_char(open);
     for(int i=0; i < v->count; i++) {
         lval_print(e, v->cell[i], false);
 
         if (i != (v->count - 1)) {
-            putchar(' ');
+            output_char(' ');
         }
     }
-    putchar(close);
+    output_char(close);
 }
 
 void lval_print_str(lval* v) {
     char* escaped = malloc(strlen(v->str) + 1);
     strcpy(escaped, v->str);
     escaped = mpcf_escape(escaped);
-    printf("\"%s\"", escaped);
+    output_char('"');
+    output_str(escaped);
+    output_char('"');
     free(escaped);
 }
 
+void lval_print_map(lenv* e, lval* v) {
+    if (v->map->edit) {
+        output_str("<transient-map>");
+        return;
+    }
+
+    output_str(v->type == LVAL_SET ? "(hash-set" : "(hash-map");
+    hamt_iter it;
+    hamt_iter_init(&it, v->map);
+    hamt_entry* entry;
+    while ((entry = hamt_iter_next(&it))) {
+        output_char(' ');
+        lval_print(e, entry->key, false);
+        if (!entry->val) continue;
+        output_char(' ');
+        lval_print(e, entry->val, false);
+    }
+    output_char(')');
+}
+
 void lval_print(lenv* e, lval* v, bool for_builtin_print) {
     switch (v->type) {
         case LVAL_INTEGER:
-            printf("%li", v->integer);
+            output_integer(v->integer);
             break;
         case LVAL_REAL:
-            printf("%lf", v->real);
+            output_real(v->real);
             break;
         case LVAL_BOOLEAN:
-            if (v->integer) printf("true");
-            else printf("false");
+            if (v->integer) output_str("true");
+            else output_str("false");
             break;
         case LVAL_SYM:
-            printf("%s", v->sym);
+            output_str(v->sym);
             break;
         case LVAL_STR:
             if (for_builtin_print) {
-                printf("%s", v->str);
+                output_str(v->str);
                 break;
             }
             lval_print_str(v);
             break;
         case LVAL_FUN:
             if (v->builtin) {
-                printf("<builtin %s>", lenv_get_function_name(e, v));
+                output_format("<builtin %s>", lenv_get_function_name(e, v));
             } else {
-                printf("(lambda ");
+                output_str("(lambda ");
                 lval_print(e, v->formals, false);
-                putchar(' ');
+                output_char(' ');
                 lval_print(e, v->body, false);
-                putchar(')');
+                output_char(')');
             }
             break;
         case LVAL_SEXPR:
@@ -1119,13 +2026,24 @@ void lval_print(lenv* e, lval* v, bool for_builtin_print) {
             if (for_builtin_print && !v->count) break;
             lval_print_expr(e, v, '{', '}');
             break;
+        case LVAL_SEQ:
+            output_str("<lazy-seq>");
+            break;
+        case LVAL_XFORM:
+            output_str("<transducer>");
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            lval_print_map(e, v);
+            break;
         case LVAL_ERR:
-            printf("Error: %s", v->err);
+            output_str("Error: ");
+            output_str(v->err);
             break;
     }
 }
 
 void lval_println(lenv* e, lval* v, bool for_builtin_print) {
     lval_print(e, v, for_builtin_print);
-    putchar('\n');
+    output_char('\n');
 }
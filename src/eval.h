@@ -1,3 +1,6 @@
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "mpc.h"
 
 #ifndef MLISP_EVAL_H
@@ -5,16 +8,23 @@
 
 typedef enum { LVAL_INTEGER, LVAL_REAL, LVAL_ERR,
                LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
-               LVAL_BOOLEAN, LVAL_STR } lval_t;
+               LVAL_BOOLEAN, LVAL_STR, LVAL_SEQ, LVAL_XFORM,
+               LVAL_MAP, LVAL_SET } lval_t;
 typedef enum { LERR_DIV_ZERO, LERR_BAD_OP,
                LERR_BAD_INTEGER, LERR_BAD_REAL, LERR_BAD_TYPE,
                LERR_UNKNOWN } lerr_t;
 
 struct lval;
 struct lenv;
+struct lseq;
+struct lxform;
+struct hamt;
 
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lseq lseq;
+typedef struct lxform lxform;
+typedef struct hamt hamt;
 typedef lval* (*lbuiltin) (lenv* e, lval* a, int level);
 struct lval {
     lval_t type;
@@ -29,6 +39,10 @@ struct lval {
     lval* formals;
     lval* body;
 
+    lseq* seq;
+    lxform* xform;
+    hamt* map;
+
     int count;
     struct lval** cell;
 };
@@ -41,13 +55,33 @@ struct lenv {
     lval** vals;
 };
 
+bool to_bool(lval* v);
+int lval_eq(lval* x, lval* y);
+uint64_t lval_hash(lval* v);
+char* ltype_name(int t);
 lenv* lenv_copy(lenv* e);
 lval* eval(lenv* e, mpc_ast_t* ast);
+lval* lval_add(lval* v, lval* x);
+lval* lval_apply(lenv* e, lval* f, lval* a);
+lval* lval_boolean(bool x);
+lval* lval_copy(lval* v);
 lval* lval_err(char* fmt, ...);
 lval* lval_eval(lenv* e, lval* v, int level);
 lval* lval_eval_sexpr(lenv* e, lval* v, int level);
+lval* lval_integer(long x);
+lval* lval_lambda(lval* formals, lval* body);
+lval* lval_map(hamt* m);
+lval* lval_pop(lval* v, int i);
+lval* lval_qexpr(void);
 lval* lval_read(mpc_ast_t* ast);
+lval* lval_real(double x);
+lval* lval_seq(lseq* s);
+lval* lval_set(hamt* m);
+lval* lval_sexpr(void);
+lval* lval_str(char* str);
+lval* lval_sym(char* sym);
 lval* lval_take(lval* v, int i);
+lval* lval_xform(lxform* xf);
 void lenv_put(lenv* e, lval* k, lval* v);
 void lval_del(lval* v);
 void lval_expr_print(lenv* e, lval* v, char open, char close);
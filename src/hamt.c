@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "eval.h"
+#include "hamt.h"
+
+static unsigned long hamt_next_edit = 1;
+
+static int hamt_popcount(uint32_t x) {
+    return __builtin_popcount(x);
+}
+
+static uint32_t hamt_bit(uint64_t hash, int shift) {
+    return 1u << ((hash >> shift) & HAMT_MASK);
+}
+
+static int hamt_index(uint32_t map, uint32_t bit) {
+    return hamt_popcount(map & (bit - 1));
+}
+
+static hamt_entry* entry_new(lval* k, lval* v) {
+    hamt_entry* e = malloc(sizeof(hamt_entry));
+    e->refs = 1;
+    e->hash = lval_hash(k);
+    e->key = k;
+    e->val = v;
+    return e;
+}
+
+static hamt_entry* entry_ref(hamt_entry* e) {
+    e->refs++;
+    return e;
+}
+
+static void entry_unref(hamt_entry* e) {
+    if (--e->refs > 0) return;
+
+    lval_del(e->key);
+    if (e->val) lval_del(e->val);
+    free(e);
+}
+
+static hamt_node* node_new(unsigned long edit) {
+    hamt_node* n = malloc(sizeof(hamt_node));
+    n->refs = 1;
+    n->edit = edit;
+    n->datamap = 0;
+    n->nodemap = 0;
+    n->entry_count = 0;
+    n->node_count = 0;
+    n->entries = NULL;
+    n->nodes = NULL;
+    return n;
+}
+
+static hamt_node* node_ref(hamt_node* n) {
+    n->refs++;
+    return n;
+}
+
+static void node_unref(hamt_node* n) {
+    if (--n->refs > 0) return;
+
+    for (int i=0; i < n->entry_count; i++) entry_unref(n->entries[i]);
+    for (int i=0; i < n->node_count; i++) node_unref(n->nodes[i]);
+    free(n->entries);
+    free(n->nodes);
+    free(n);
+}
+
+static hamt_node* node_clone(hamt_node* n, unsigned long edit) {
+    hamt_node* c = node_new(edit);
+    c->datamap = n->datamap;
+    c->nodemap = n->nodemap;
+    c->entry_count = n->entry_count;
+    c->node_count = n->node_count;
+
+    c->entries = malloc(sizeof(hamt_entry*) * (n->entry_count ? n->entry_count : 1));
+    for (int i=0; i < n->entry_count; i++) c->entries[i] = entry_ref(n->entries[i]);
+
+    c->nodes = malloc(sizeof(hamt_node*) * (n->node_count ? n->node_count : 1));
+    for (int i=0; i < n->node_count; i++) c->nodes[i] = node_ref(n->nodes[i]);
+    return c;
+}
+
+/* Returns a new reference to a node that EDIT may mutate: N itself if owned, else a copy. */
+static hamt_node* node_editable(hamt_node* n, unsigned long edit) {
+    if (edit && n->edit == edit) return node_ref(n);
+    return node_clone(n, edit);
+}
+
+static void node_insert_entry(hamt_node* n, int i, hamt_entry* e) {
+    n->entries = realloc(n->entries, sizeof(hamt_entry*) * (n->entry_count + 1));
+    memmove(&n->entries[i + 1], &n->entries[i], sizeof(hamt_entry*) * (n->entry_count - i));
+    n->entries[i] = e;
+    n->entry_count++;
+}
+
+static void node_remove_entry(hamt_node* n, int i) {
+    memmove(&n->entries[i], &n->entries[i + 1], sizeof(hamt_entry*) * (n->entry_count - i - 1));
+    n->entry_count--;
+}
+
+static void node_insert_node(hamt_node* n, int i, hamt_node* child) {
+    n->nodes = realloc(n->nodes, sizeof(hamt_node*) * (n->node_count + 1));
+    memmove(&n->nodes[i + 1], &n->nodes[i], sizeof(hamt_node*) * (n->node_count - i));
+    n->nodes[i] = child;
+    n->node_count++;
+}
+
+static void node_remove_node(hamt_node* n, int i) {
+    memmove(&n->nodes[i], &n->nodes[i + 1], sizeof(hamt_node*) * (n->node_count - i - 1));
+    n->node_count--;
+}
+
+static bool entry_matches(hamt_entry* e, uint64_t hash, lval* k) {
+    return e->hash == hash && lval_eq(e->key, k);
+}
+
+/* Builds the subtree holding two entries whose hashes agree below SHIFT. */
+static hamt_node* node_merge(hamt_entry* a, hamt_entry* b, int shift, unsigned long edit) {
+    hamt_node* n = node_new(edit);
+    if (shift >= HAMT_HASH_BITS) {
+        node_insert_entry(n, 0, a);
+        node_insert_entry(n, 1, b);
+        return n;
+    }
+
+    uint32_t abit = hamt_bit(a->hash, shift);
+    uint32_t bbit = hamt_bit(b->hash, shift);
+    if (abit == bbit) {
+        n->nodemap = abit;
+        node_insert_node(n, 0, node_merge(a, b, shift + HAMT_BITS, edit));
+    } else {
+        n->datamap = abit | bbit;
+        node_insert_entry(n, 0, abit < bbit ? a : b);
+        node_insert_entry(n, 1, abit < bbit ? b : a);
+    }
+    return n;
+}
+
+/* Returns a new reference to N with ENTRY (owned) stored in it. */
+static hamt_node* node_assoc(hamt_node* n, unsigned long edit, int shift,
+                             hamt_entry* entry, bool* added) {
+    hamt_node* m;
+
+    if (shift >= HAMT_HASH_BITS) {
+        for (int i=0; i < n->entry_count; i++) {
+            if (entry_matches(n->entries[i], entry->hash, entry->key)) {
+                m = node_editable(n, edit);
+                entry_unref(m->entries[i]);
+                m->entries[i] = entry;
+                return m;
+            }
+        }
+        m = node_editable(n, edit);
+        node_insert_entry(m, m->entry_count, entry);
+        *added = true;
+        return m;
+    }
+
+    uint32_t bit = hamt_bit(entry->hash, shift);
+
+    if (n->datamap & bit) {
+        int i = hamt_index(n->datamap, bit);
+        hamt_entry* old = n->entries[i];
+        m = node_editable(n, edit);
+        if (entry_matches(old, entry->hash, entry->key)) {
+            entry_unref(m->entries[i]);
+            m->entries[i] = entry;
+            return m;
+        }
+
+        hamt_node* child = node_merge(entry_ref(old), entry, shift + HAMT_BITS, edit);
+        node_remove_entry(m, i);
+        entry_unref(old);
+        m->datamap &= ~bit;
+        m->nodemap |= bit;
+        node_insert_node(m, hamt_index(m->nodemap, bit), child);
+        *added = true;
+        return m;
+    }
+
+    if (n->nodemap & bit) {
+        int i = hamt_index(n->nodemap, bit);
+        hamt_node* child = node_assoc(n->nodes[i], edit, shift + HAMT_BITS, entry, added);
+        m = node_editable(n, edit);
+        node_unref(m->nodes[i]);
+        m->nodes[i] = child;
+        return m;
+    }
+
+    m = node_editable(n, edit);
+    node_insert_entry(m, hamt_index(m->datamap, bit), entry);
+    m->datamap |= bit;
+    *added = true;
+    return m;
+}
+
+/* Returns a new reference to N without key K. */
+static hamt_node* node_dissoc(hamt_node* n, unsigned long edit, int shift,
+                              uint64_t hash, lval* k, bool* removed) {
+    hamt_node* m;
+
+    if (shift >= HAMT_HASH_BITS) {
+        for (int i=0; i < n->entry_count; i++) {
+            if (entry_matches(n->entries[i], hash, k)) {
+                m = node_editable(n, edit);
+                entry_unref(m->entries[i]);
+                node_remove_entry(m, i);
+                *removed = true;
+                return m;
+            }
+        }
+        return node_ref(n);
+    }
+
+    uint32_t bit = hamt_bit(hash, shift);
+
+    if (n->datamap & bit) {
+        int i = hamt_index(n->datamap, bit);
+        if (!entry_matches(n->entries[i], hash, k)) return node_ref(n);
+
+        m = node_editable(n, edit);
+        entry_unref(m->entries[i]);
+        node_remove_entry(m, i);
+        m->datamap &= ~bit;
+        *removed = true;
+        return m;
+    }
+
+    if (n->nodemap & bit) {
+        int i = hamt_index(n->nodemap, bit);
+        hamt_node* child = node_dissoc(n->nodes[i], edit, shift + HAMT_BITS, hash, k, removed);
+        if (!*removed) {
+            node_unref(child);
+            return node_ref(n);
+        }
+
+        m = node_editable(n, edit);
+        node_unref(m->nodes[i]);
+        if (child->node_count == 0 && child->entry_count <= 1) {
+            /* Keep the trie canonical: a lone entry moves up into its parent. */
+            node_remove_node(m, i);
+            m->nodemap &= ~bit;
+            if (child->entry_count == 1) {
+                node_insert_entry(m, hamt_index(m->datamap, bit), entry_ref(child->entries[0]));
+                m->datamap |= bit;
+            }
+            node_unref(child);
+        } else {
+            m->nodes[i] = child;
+        }
+        return m;
+    }
+
+    return node_ref(n);
+}
+
+hamt* hamt_alloc(hamt_node* root, long count, unsigned long edit) {
+    hamt* m = malloc(sizeof(hamt));
+    m->refs = 1;
+    m->count = count;
+    m->edit = edit;
+    m->root = root;
+    return m;
+}
+
+hamt* hamt_new(void) {
+    return hamt_alloc(node_new(0), 0, 0);
+}
+
+hamt* hamt_ref(hamt* m) {
+    m->refs++;
+    return m;
+}
+
+void hamt_unref(hamt* m) {
+    if (--m->refs > 0) return;
+
+    node_unref(m->root);
+    free(m);
+}
+
+static hamt_entry* hamt_find(hamt* m, uint64_t hash, lval* k) {
+    hamt_node* n = m->root;
+
+    for (int shift=0; ; shift += HAMT_BITS) {
+        if (shift >= HAMT_HASH_BITS) {
+            for (int i=0; i < n->entry_count; i++) {
+                if (entry_matches(n->entries[i], hash, k)) return n->entries[i];
+            }
+            return NULL;
+        }
+
+        uint32_t bit = hamt_bit(hash, shift);
+        if (n->datamap & bit) {
+            hamt_entry* e = n->entries[hamt_index(n->datamap, bit)];
+            return entry_matches(e, hash, k) ? e : NULL;
+        }
+        if (!(n->nodemap & bit)) return NULL;
+        n = n->nodes[hamt_index(n->nodemap, bit)];
+    }
+}
+
+/* Returns the value stored under K, still owned by the map, or NULL. */
+lval* hamt_get(hamt* m, lval* k) {
+    hamt_entry* e = hamt_find(m, lval_hash(k), k);
+    return e ? e->val : NULL;
+}
+
+bool hamt_contains(hamt* m, lval* k) {
+    return hamt_find(m, lval_hash(k), k) != NULL;
+}
+
+/* Consumes K and V. Returns a new map and leaves M untouched. */
+hamt* hamt_assoc(hamt* m, lval* k, lval* v) {
+    bool added = false;
+    hamt_node* root = node_assoc(m->root, 0, 0, entry_new(k, v), &added);
+    return hamt_alloc(root, m->count + added, 0);
+}
+
+hamt* hamt_dissoc(hamt* m, lval* k) {
+    bool removed = false;
+    hamt_node* root = node_dissoc(m->root, 0, 0, lval_hash(k), k, &removed);
+    return hamt_alloc(root, m->count - removed, 0);
+}
+
+hamt* hamt_transient(hamt* m) {
+    return hamt_alloc(node_ref(m->root), m->count, hamt_next_edit++);
+}
+
+hamt* hamt_transient_empty(void) {
+    hamt* empty = hamt_new();
+    hamt* t = hamt_transient(empty);
+    hamt_unref(empty);
+    return t;
+}
+
+/* Consumes K and V. T must be transient. */
+void hamt_assoc_mut(hamt* t, lval* k, lval* v) {
+    bool added = false;
+    hamt_node* root = node_assoc(t->root, t->edit, 0, entry_new(k, v), &added);
+    node_unref(t->root);
+    t->root = root;
+    t->count += added;
+}
+
+void hamt_dissoc_mut(hamt* t, lval* k) {
+    bool removed = false;
+    hamt_node* root = node_dissoc(t->root, t->edit, 0, lval_hash(k), k, &removed);
+    node_unref(t->root);
+    t->root = root;
+    t->count -= removed;
+}
+
+void hamt_persistent(hamt* t) {
+    t->edit = 0;
+}
+
+void hamt_iter_init(hamt_iter* it, hamt* m) {
+    it->depth = 0;
+    it->nodes[0] = m->root;
+    it->pos[0] = 0;
+}
+
+/* Walks entries depth first: each node's own entries, then its children. */
+hamt_entry* hamt_iter_next(hamt_iter* it) {
+    while (it->depth >= 0) {
+        hamt_node* n = it->nodes[it->depth];
+        int pos = it->pos[it->depth]++;
+
+        if (pos < n->entry_count) return n->entries[pos];
+
+        pos -= n->entry_count;
+        if (pos < n->node_count) {
+            it->depth++;
+            it->nodes[it->depth] = n->nodes[pos];
+            it->pos[it->depth] = 0;
+        } else {
+            it->depth--;
+        }
+    }
+    return NULL;
+}
+
+bool hamt_eq(hamt* x, hamt* y) {
+    if (x == y) return true;
+    if (x->count != y->count) return false;
+
+    hamt_iter it;
+    hamt_iter_init(&it, x);
+    hamt_entry* e;
+    while ((e = hamt_iter_next(&it))) {
+        hamt_entry* found = hamt_find(y, e->hash, e->key);
+        if (!found) return false;
+        if (!e->val != !found->val) return false;
+        if (e->val && !lval_eq(e->val, found->val)) return false;
+    }
+    return true;
+}
+
+/* Order independent, so equal maps hash equally whatever their insertion history. */
+uint64_t hamt_hash(hamt* m) {
+    uint64_t h = 0;
+    hamt_iter it;
+    hamt_iter_init(&it, m);
+    hamt_entry* e;
+    while ((e = hamt_iter_next(&it))) {
+        uint64_t eh = e->hash * 31;
+        if (e->val) eh += lval_hash(e->val);
+        h += eh ^ (eh >> 29);
+    }
+    return h;
+}
@@ -0,0 +1,80 @@
+#ifndef MLISP_HAMT_H
+#define MLISP_HAMT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "eval.h"
+
+/*
+ * Persistent hash array mapped trie keyed by lval_hash/lval_eq. Nodes and
+ * entries are reference counted and shared between versions, so a
+ * persistent update copies only the O(log32 n) nodes on its path. Sets use
+ * the same trie with NULL values.
+ *
+ * A transient handle (edit != 0) owns the nodes it creates and updates
+ * them in place, which makes batch builds cheap. hamt_persistent freezes it.
+ */
+
+#define HAMT_BITS 5
+#define HAMT_MASK 31
+#define HAMT_HASH_BITS 64
+#define HAMT_MAX_DEPTH 16
+
+typedef struct hamt_entry hamt_entry;
+typedef struct hamt_node hamt_node;
+
+struct hamt_entry {
+    int refs;
+    uint64_t hash;
+    lval* key;
+    lval* val;
+};
+
+struct hamt_node {
+    int refs;
+    unsigned long edit;
+    uint32_t datamap;
+    uint32_t nodemap;
+
+    int entry_count;
+    int node_count;
+    hamt_entry** entries;
+    hamt_node** nodes;
+};
+
+struct hamt {
+    int refs;
+    long count;
+    unsigned long edit;
+    hamt_node* root;
+};
+
+typedef struct {
+    int depth;
+    hamt_node* nodes[HAMT_MAX_DEPTH];
+    int pos[HAMT_MAX_DEPTH];
+} hamt_iter;
+
+hamt* hamt_new(void);
+hamt* hamt_ref(hamt* m);
+void hamt_unref(hamt* m);
+
+lval* hamt_get(hamt* m, lval* k);
+bool hamt_contains(hamt* m, lval* k);
+hamt* hamt_assoc(hamt* m, lval* k, lval* v);
+hamt* hamt_dissoc(hamt* m, lval* k);
+
+hamt* hamt_transient(hamt* m);
+hamt* hamt_transient_empty(void);
+void hamt_assoc_mut(hamt* t, lval* k, lval* v);
+void hamt_dissoc_mut(hamt* t, lval* k);
+void hamt_persistent(hamt* t);
+
+bool hamt_eq(hamt* x, hamt* y);
+uint64_t hamt_hash(hamt* m);
+
+void hamt_iter_init(hamt_iter* it, hamt* m);
+hamt_entry* hamt_iter_next(hamt_iter* it);
+
+#endif
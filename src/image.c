@@ -0,0 +1,467 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eval.h"
+#include "hamt.h"
+#include "image.h"
+#include "lseq.h"
+#include "output.h"
+#include "xform.h"
+
+static void put_bytes(image_buf* b, const void* data, size_t n) {
+    if (b->length + n > b->capacity) {
+        b->capacity = b->capacity ? b->capacity : 4096;
+        while (b->length + n > b->capacity) b->capacity *= 2;
+        b->data = realloc(b->data, b->capacity);
+    }
+    memcpy(b->data + b->length, data, n);
+    b->length += n;
+}
+
+static void put_u8(image_buf* b, uint8_t x) {
+    put_bytes(b, &x, 1);
+}
+
+/* Unsigned LEB128: seven bits per byte, low bits first, with the top bit set on all but the last byte. */
+static void put_uint(image_buf* b, uint64_t x) {
+    unsigned char bytes[IMAGE_UINT_MAX];
+    int n = 0;
+    while (x >= 0x80) {
+        bytes[n++] = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    bytes[n++] = x;
+    put_bytes(b, bytes, n);
+}
+
+/* Signed values are zigzag encoded first, so small negative numbers stay short too. */
+static void put_int(image_buf* b, int64_t x) {
+    put_uint(b, ((uint64_t) x << 1) ^ (uint64_t) (x >> 63));
+}
+
+static void put_real(image_buf* b, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    unsigned char bytes[8];
+    for (int i=0; i < 8; i++) bytes[i] = (bits >> (i * 8)) & 0xff;
+    put_bytes(b, bytes, 8);
+}
+
+static void put_str(image_buf* b, const char* s) {
+    size_t n = strlen(s);
+    put_uint(b, n);
+    put_bytes(b, s, n);
+}
+
+static const unsigned char* get_bytes(image_cursor* c, size_t n) {
+    if (c->failed || (size_t) (c->end - c->p) < n) {
+        c->failed = true;
+        return NULL;
+    }
+    const unsigned char* p = c->p;
+    c->p += n;
+    return p;
+}
+
+static uint8_t get_u8(image_cursor* c) {
+    const unsigned char* p = get_bytes(c, 1);
+    return p ? p[0] : 0;
+}
+
+/* Fails C on a varint that runs past the input or past 64 bits. */
+static uint64_t get_uint(image_cursor* c) {
+    uint64_t x = 0;
+    for (int shift=0; shift < 64; shift += 7) {
+        const unsigned char* p = get_bytes(c, 1);
+        if (!p) return 0;
+        if (shift == 63 && *p > 1) break;
+        x |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p & 0x80)) return x;
+    }
+    c->failed = true;
+    return 0;
+}
+
+static int64_t get_int(image_cursor* c) {
+    uint64_t x = get_uint(c);
+    return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+}
+
+static double get_real(image_cursor* c) {
+    const unsigned char* p = get_bytes(c, 8);
+    uint64_t bits = 0;
+    if (p) {
+        for (int i=0; i < 8; i++) bits |= (uint64_t) p[i] << (i * 8);
+    }
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+/* Element counts are bounded by the bytes left, which keeps bad input from forcing huge allocations. */
+static uint64_t get_count(image_cursor* c) {
+    uint64_t n = get_uint(c);
+    if (n > (uint64_t) (c->end - c->p)) {
+        c->failed = true;
+        return 0;
+    }
+    return n;
+}
+
+/* Returns a malloced, NUL terminated copy of the next string. */
+static char* get_str(image_cursor* c) {
+    uint64_t n = get_count(c);
+    const unsigned char* p = get_bytes(c, n);
+    char* s = malloc(n + 1);
+    if (p) memcpy(s, p, n);
+    s[p ? n : 0] = '\0';
+    return s;
+}
+
+static char* builtin_name(lenv* builtins, lbuiltin f) {
+    for (int i=0; i < builtins->count; i++) {
+        lval* v = builtins->vals[i];
+        if (v->type == LVAL_FUN && v->builtin == f) return builtins->syms[i];
+    }
+    return "";
+}
+
+static lval* builtin_named(image_cursor* c, const char* name) {
+    for (int i=0; c->builtins && i < c->builtins->count; i++) {
+        if (strcmp(c->builtins->syms[i], name) == 0) return lval_copy(c->builtins->vals[i]);
+    }
+    c->failed = true;
+    return lval_sexpr();
+}
+
+static void put_optional(image_buf* b, lenv* builtins, lval* v) {
+    put_u8(b, v != NULL);
+    if (v) image_put_lval(b, builtins, v);
+}
+
+static lval* get_optional(image_cursor* c) {
+    return get_u8(c) ? image_get_lval(c) : NULL;
+}
+
+static void put_seq(image_buf* b, lenv* builtins, lseq* s) {
+    put_u8(b, s->kind);
+    put_int(b, s->start);
+    put_int(b, s->end);
+    put_int(b, s->step);
+    put_u8(b, s->bounded);
+    put_int(b, s->n);
+    put_optional(b, builtins, s->fn);
+    put_optional(b, builtins, s->seed);
+    put_u8(b, s->src != NULL);
+    if (s->src) put_seq(b, builtins, s->src);
+}
+
+static bool is_fun(lval* v) {
+    return v && v->type == LVAL_FUN;
+}
+
+/* Fails C unless S is a known kind with the fields lseq_iter_fill needs for it. */
+static void check_seq(image_cursor* c, lseq* s) {
+    bool ok = false;
+    switch (s->kind) {
+        case LSEQ_RANGE:
+            ok = s->step != 0;
+            break;
+        case LSEQ_ITERATE:
+            ok = is_fun(s->fn) && s->seed;
+            break;
+        case LSEQ_LIST:
+            ok = s->seed && s->seed->type == LVAL_QEXPR;
+            break;
+        case LSEQ_TAKE:
+        case LSEQ_DROP:
+            ok = s->src != NULL;
+            break;
+        case LSEQ_MAP:
+        case LSEQ_FILTER:
+            ok = is_fun(s->fn) && s->src;
+            break;
+    }
+    if (!ok) c->failed = true;
+}
+
+static lseq* get_seq(image_cursor* c) {
+    uint8_t kind = get_u8(c);
+    lseq* s = lseq_new(kind <= LSEQ_FILTER ? kind : LSEQ_RANGE);
+    if (kind > LSEQ_FILTER) c->failed = true;
+    s->start = get_int(c);
+    s->end = get_int(c);
+    s->step = get_int(c);
+    s->bounded = get_u8(c);
+    s->n = get_int(c);
+    s->fn = get_optional(c);
+    s->seed = get_optional(c);
+    if (get_u8(c)) s->src = get_seq(c);
+    check_seq(c, s);
+    return s;
+}
+
+static void put_map(image_buf* b, lenv* builtins, lval* v) {
+    put_u8(b, v->map->edit != 0);
+    put_uint(b, v->map->count);
+
+    hamt_iter it;
+    hamt_entry* entry;
+    hamt_iter_init(&it, v->map);
+    while ((entry = hamt_iter_next(&it))) {
+        image_put_lval(b, builtins, entry->key);
+        if (v->type == LVAL_MAP) image_put_lval(b, builtins, entry->val);
+    }
+}
+
+static hamt* get_map(image_cursor* c, lval_t type) {
+    bool transient = get_u8(c);
+    uint64_t count = get_count(c);
+
+    hamt* t = hamt_transient_empty();
+    for (uint64_t i=0; i < count && !c->failed; i++) {
+        lval* k = image_get_lval(c);
+        lval* v = type == LVAL_MAP ? image_get_lval(c) : NULL;
+        hamt_assoc_mut(t, k, v);
+    }
+    if (!transient) hamt_persistent(t);
+    return t;
+}
+
+void image_put_lval(image_buf* b, lenv* builtins, lval* v) {
+    put_u8(b, v->type);
+
+    switch (v->type) {
+        case LVAL_INTEGER:
+        case LVAL_BOOLEAN:
+            put_int(b, v->integer);
+            break;
+        case LVAL_REAL:
+            put_real(b, v->real);
+            break;
+        case LVAL_ERR:
+            put_str(b, v->err);
+            break;
+        case LVAL_SYM:
+            put_str(b, v->sym);
+            break;
+        case LVAL_STR:
+            put_str(b, v->str);
+            break;
+        case LVAL_FUN:
+            put_u8(b, v->builtin != NULL);
+            if (v->builtin) {
+                put_str(b, builtin_name(builtins, v->builtin));
+                break;
+            }
+            image_put_env(b, builtins, v->env);
+            image_put_lval(b, builtins, v->formals);
+            image_put_lval(b, builtins, v->body);
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            put_uint(b, v->count);
+            for (int i=0; i < v->count; i++) image_put_lval(b, builtins, v->cell[i]);
+            break;
+        case LVAL_SEQ:
+            put_seq(b, builtins, v->seq);
+            break;
+        case LVAL_XFORM:
+            put_uint(b, v->xform->count);
+            for (int i=0; i < v->xform->count; i++) {
+                xform_stage* stage = &v->xform->stages[i];
+                put_u8(b, stage->kind);
+                put_int(b, stage->n);
+                put_optional(b, builtins, stage->fn);
+            }
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            put_map(b, builtins, v);
+            break;
+    }
+}
+
+lval* image_get_lval(image_cursor* c) {
+    lval_t type = get_u8(c);
+    if (c->failed) return lval_sexpr();
+
+    switch (type) {
+        case LVAL_INTEGER:
+            return lval_integer(get_int(c));
+        case LVAL_BOOLEAN:
+            return lval_boolean(get_int(c) != 0);
+        case LVAL_REAL:
+            return lval_real(get_real(c));
+        case LVAL_ERR:
+        case LVAL_SYM:
+        case LVAL_STR: {
+            char* s = get_str(c);
+            lval* x = type == LVAL_ERR ? lval_err("%s", s) : type == LVAL_SYM ? lval_sym(s) : lval_str(s);
+            free(s);
+            return x;
+        }
+        case LVAL_FUN: {
+            if (get_u8(c)) {
+                char* name = get_str(c);
+                lval* x = builtin_named(c, name);
+                free(name);
+                return x;
+            }
+            lenv* env = lenv_new();
+            image_get_env(c, env);
+            lval* formals = image_get_lval(c);
+            lval* body = image_get_lval(c);
+            lval* x = lval_lambda(formals, body);
+            lenv_del(x->env);
+            x->env = env;
+            return x;
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            uint64_t count = get_count(c);
+            lval* x = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            if (count) x->cell = malloc(sizeof(lval*) * count);
+            for (uint64_t i=0; i < count && !c->failed; i++) {
+                x->cell[x->count++] = image_get_lval(c);
+            }
+            return x;
+        }
+        case LVAL_SEQ:
+            return lval_seq(get_seq(c));
+        case LVAL_XFORM: {
+            uint64_t count = get_count(c);
+            lxform* xf = xform_alloc(count);
+            xf->count = 0;
+            for (uint64_t i=0; i < count && !c->failed; i++) {
+                xform_stage* stage = &xf->stages[xf->count++];
+                uint8_t kind = get_u8(c);
+                stage->kind = kind <= XFORM_DROP ? kind : XFORM_TAKE;
+                stage->n = get_int(c);
+                stage->fn = get_optional(c);
+                bool needs_fn = kind == XFORM_MAP || kind == XFORM_FILTER;
+                if (kind > XFORM_DROP || (needs_fn && !is_fun(stage->fn))) c->failed = true;
+            }
+            return lval_xform(xf);
+        }
+        case LVAL_MAP:
+            return lval_map(get_map(c, type));
+        case LVAL_SET:
+            return lval_set(get_map(c, type));
+    }
+
+    c->failed = true;
+    return lval_sexpr();
+}
+
+void image_put_env(image_buf* b, lenv* builtins, lenv* e) {
+    put_uint(b, e->count);
+    for (int i=0; i < e->count; i++) {
+        put_str(b, e->syms[i]);
+        image_put_lval(b, builtins, e->vals[i]);
+    }
+}
+
+void image_get_env(image_cursor* c, lenv* e) {
+    uint64_t count = get_count(c);
+    for (uint64_t i=0; i < count && !c->failed; i++) {
+        char* name = get_str(c);
+        lval* k = lval_sym(name);
+        lval* v = image_get_lval(c);
+        lenv_put(e, k, v);
+        lval_del(k);
+        lval_del(v);
+        free(name);
+    }
+}
+
+void image_put_header(image_buf* b) {
+    put_bytes(b, IMAGE_MAGIC, strlen(IMAGE_MAGIC));
+    put_uint(b, IMAGE_VERSION);
+}
+
+void image_put_uint(image_buf* b, uint64_t x) {
+    put_uint(b, x);
+}
+
+uint64_t image_get_uint(image_cursor* c) {
+    return get_uint(c);
+}
+
+bool image_get_header(image_cursor* c) {
+    const unsigned char* magic = get_bytes(c, strlen(IMAGE_MAGIC));
+    if (!magic || memcmp(magic, IMAGE_MAGIC, strlen(IMAGE_MAGIC)) != 0) return false;
+    return get_uint(c) == IMAGE_VERSION && !c->failed;
+}
+
+/* Writes every binding of the global environment E to PATH. */
+bool image_dump(lenv* e, const char* path) {
+    lenv* builtins = lenv_new();
+    lenv_add_builtins(builtins);
+
+    image_buf b = {NULL, 0, 0};
+    image_put_header(&b);
+    image_put_env(&b, builtins, e);
+    lenv_del(builtins);
+
+    FILE* fp = fopen(path, "wb");
+    bool ok = fp && fwrite(b.data, 1, b.length, fp) == b.length;
+    if (fp && fclose(fp) != 0) ok = false;
+    if (!ok) output_format("Error writing image %s\n", path);
+
+    free(b.data);
+    return ok;
+}
+
+/* Returns a global environment holding the builtins plus the bindings in the LENGTH byte image at DATA, or NULL. */
+lenv* image_load_bytes(const void* data, size_t length) {
+    lenv* builtins = lenv_new();
+    lenv_add_builtins(builtins);
+    image_cursor c = {data, (const unsigned char*) data + length, builtins, false};
+
+    lenv* e = NULL;
+    if (image_get_header(&c)) {
+        e = lenv_new();
+        lenv_add_builtins(e);
+        image_get_env(&c, e);
+    }
+
+    if (e && c.failed) {
+        lenv_del(e);
+        e = NULL;
+    }
+    lenv_del(builtins);
+    return e;
+}
+
+/* Maps the image at PATH and returns a global environment holding the builtins plus its bindings. */
+lenv* image_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        output_format("Error reading image %s\n", path);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        output_format("Error reading image %s\n", path);
+        return NULL;
+    }
+
+    lenv* e = image_load_bytes(data, st.st_size);
+    if (!e) output_format("Error loading image %s: not a valid version %d image\n", path, IMAGE_VERSION);
+    munmap(data, st.st_size);
+    return e;
+}
@@ -0,0 +1,53 @@
+#ifndef MLISP_IMAGE_H
+#define MLISP_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eval.h"
+
+/*
+ * Binary encoding of lvals and environments. An image holds no pointers:
+ * builtins are stored by the name they were registered under and resolved
+ * against the builtins of the loading process, and lazy sequences, maps
+ * and closure environments are written out by value. Integers, counts and
+ * lengths are LEB128 varints, signed ones zigzag encoded, and reals are 8
+ * little endian bytes, so images move freely between processes and machines.
+ */
+
+#define IMAGE_MAGIC "MLISPIMG"
+#define IMAGE_VERSION 2
+
+/* The longest varint, for a 64 bit value. */
+#define IMAGE_UINT_MAX 10
+
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+} image_buf;
+
+/* Decoding state. FAILED is set on truncated or malformed input. */
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    lenv* builtins;
+    bool failed;
+} image_cursor;
+
+void image_put_header(image_buf* b);
+void image_put_uint(image_buf* b, uint64_t x);
+void image_put_lval(image_buf* b, lenv* builtins, lval* v);
+void image_put_env(image_buf* b, lenv* builtins, lenv* e);
+
+bool image_get_header(image_cursor* c);
+uint64_t image_get_uint(image_cursor* c);
+lval* image_get_lval(image_cursor* c);
+void image_get_env(image_cursor* c, lenv* e);
+
+bool image_dump(lenv* e, const char* path);
+lenv* image_load(const char* path);
+lenv* image_load_bytes(const void* data, size_t length);
+
+#endif
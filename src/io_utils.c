@@ -1,6 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "io_utils.h"
 #include "mpc.h"
+#include "output.h"
 
 void print_padding(int size, char* c) {
     for(int i=0; i < size; i++) {
@@ -27,24 +37,60 @@ void print_ast(mpc_ast_t* ast, int level) {
     }
 }
 
-char* read_file(char* file_path) {
-    FILE* fp = fopen(file_path, "r");
-    if (!fp) {
-        printf("Error reading init file %s\n", file_path);
-        return NULL;
+/* Reads FD to the end, for pipes and other files that cannot be mapped. */
+static bool read_stream(int fd, mapped_file* f) {
+    size_t capacity = 65536;
+    f->data = malloc(capacity);
+    f->length = 0;
+    f->mapped = false;
+
+    while (1) {
+        if (f->length == capacity) {
+            capacity *= 2;
+            f->data = realloc(f->data, capacity);
+        }
+        ssize_t n = read(fd, f->data + f->length, capacity - f->length);
+        if (n == 0) return true;
+        if (n < 0) {
+            free(f->data);
+            return false;
+        }
+        f->length += n;
+    }
+}
+
+/*
+ * Maps the regular file at FILE_PATH read-only, so callers see its bytes
+ * without a copy. Pipes, empty files and anything else mmap refuses are
+ * read into memory instead. Release F with unmap_file.
+ */
+bool map_file(const char* file_path, mapped_file* f) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        output_format("Error reading file %s\n", file_path);
+        return false;
     }
 
-    int buffer_size = sizeof(char) * 1000;
-    char* buffer = malloc(buffer_size);
-    char c;
-    int i = 0;
-    while ((c = getc(fp)) != EOF) {
-        if (i == (buffer_size - 2)) {
-            buffer = realloc(buffer, buffer_size * 2);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            close(fd);
+            f->data = data;
+            f->length = st.st_size;
+            f->mapped = true;
+            return true;
         }
-        buffer[i++] = c;
     }
-    buffer[i] = '\0';
-    fclose(fp);
-    return buffer;
+
+    bool ok = read_stream(fd, f);
+    close(fd);
+    if (!ok) output_format("Error reading file %s\n", file_path);
+    return ok;
+}
+
+void unmap_file(mapped_file* f) {
+    if (f->mapped) munmap(f->data, f->length);
+    else free(f->data);
 }
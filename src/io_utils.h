@@ -1,7 +1,19 @@
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "mpc.h"
 
 #ifndef MLISP_IO_UTILS_H
 #define MLISP_IO_UTILS_H
+
+/* File contents, either mapped read-only or read into a malloced buffer. Not NUL terminated. */
+typedef struct {
+    char* data;
+    size_t length;
+    bool mapped;
+} mapped_file;
+
 void print_ast(mpc_ast_t* ast, int level);
-char* read_file(char* file_path);
+bool map_file(const char* file_path, mapped_file* f);
+void unmap_file(mapped_file* f);
 #endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "eval.h"
+#include "lseq.h"
+
+lseq* lseq_new(lseq_kind_t kind) {
+    lseq* s = malloc(sizeof(lseq));
+    s->kind = kind;
+    s->refs = 1;
+    s->start = 0;
+    s->end = 0;
+    s->step = 1;
+    s->bounded = false;
+    s->n = 0;
+    s->fn = NULL;
+    s->seed = NULL;
+    s->src = NULL;
+    return s;
+}
+
+lseq* lseq_range(long start, long end, long step, bool bounded) {
+    lseq* s = lseq_new(LSEQ_RANGE);
+    s->start = start;
+    s->end = end;
+    s->step = step;
+    s->bounded = bounded;
+    return s;
+}
+
+lseq* lseq_iterate(lval* fn, lval* seed) {
+    lseq* s = lseq_new(LSEQ_ITERATE);
+    s->fn = fn;
+    s->seed = seed;
+    return s;
+}
+
+lseq* lseq_list(lval* list) {
+    lseq* s = lseq_new(LSEQ_LIST);
+    s->seed = list;
+    return s;
+}
+
+lseq* lseq_take(lseq* src, long n) {
+    lseq* s = lseq_new(LSEQ_TAKE);
+    s->src = src;
+    s->n = n;
+    return s;
+}
+
+lseq* lseq_drop(lseq* src, long n) {
+    lseq* s = lseq_new(LSEQ_DROP);
+    s->src = src;
+    s->n = n;
+    return s;
+}
+
+lseq* lseq_map(lval* fn, lseq* src) {
+    lseq* s = lseq_new(LSEQ_MAP);
+    s->fn = fn;
+    s->src = src;
+    return s;
+}
+
+lseq* lseq_filter(lval* fn, lseq* src) {
+    lseq* s = lseq_new(LSEQ_FILTER);
+    s->fn = fn;
+    s->src = src;
+    return s;
+}
+
+/* Consumes COLL, which must be a lazy sequence or a Q-Expression. */
+lseq* lseq_of(lval* coll) {
+    if (coll->type == LVAL_SEQ) {
+        lseq* s = lseq_ref(coll->seq);
+        lval_del(coll);
+        return s;
+    }
+    return lseq_list(coll);
+}
+
+lseq* lseq_ref(lseq* s) {
+    s->refs++;
+    return s;
+}
+
+void lseq_unref(lseq* s) {
+    if (--s->refs > 0) return;
+
+    if (s->fn) lval_del(s->fn);
+    if (s->seed) lval_del(s->seed);
+    if (s->src) lseq_unref(s->src);
+    free(s);
+}
+
+/* True if walking S calls a user function, directly or through its sources. */
+static bool lseq_calls_fn(lseq* s) {
+    for (; s; s=s->src) {
+        if (s->fn) return true;
+    }
+    return false;
+}
+
+lseq_iter* lseq_iter_new(lenv* e, lseq* s) {
+    lseq_iter* it = malloc(sizeof(lseq_iter));
+    it->seq = lseq_ref(s);
+    it->env = e;
+    it->src = s->src ? lseq_iter_new(e, s->src) : NULL;
+    it->cur = NULL;
+    it->done = false;
+    it->limit = lseq_calls_fn(s) ? 1 : LSEQ_CHUNK_SIZE;
+    it->len = 0;
+    it->next = 0;
+
+    switch (s->kind) {
+        case LSEQ_RANGE:
+            it->pos = s->start;
+            break;
+        case LSEQ_ITERATE:
+            it->pos = 0;
+            break;
+        default:
+            it->pos = s->n;
+            break;
+    }
+    return it;
+}
+
+void lseq_iter_del(lseq_iter* it) {
+    for (int i=it->next; i < it->len; i++) {
+        lval_del(it->chunk[i]);
+    }
+    if (it->cur) lval_del(it->cur);
+    if (it->src) lseq_iter_del(it->src);
+    lseq_unref(it->seq);
+    free(it);
+}
+
+static void lseq_iter_push(lseq_iter* it, lval* x) {
+    it->chunk[it->len++] = x;
+    if (x->type == LVAL_ERR) it->done = true;
+}
+
+static bool lseq_range_has_next(lseq* s, long i) {
+    if (!s->bounded) return true;
+    return s->step > 0 ? i < s->end : i > s->end;
+}
+
+/* Realizes the next chunk of IT. Errors end the sequence after being yielded. */
+static void lseq_iter_fill(lseq_iter* it) {
+    lseq* s = it->seq;
+    it->len = 0;
+    it->next = 0;
+
+    while (!it->done && it->len < it->limit) {
+        lval* x;
+        switch (s->kind) {
+            case LSEQ_RANGE:
+                if (!lseq_range_has_next(s, it->pos)) {
+                    it->done = true;
+                    break;
+                }
+                lseq_iter_push(it, lval_integer(it->pos));
+                /* A step past LONG_MAX or LONG_MIN ends the range instead of wrapping. */
+                if (s->step > 0 ? it->pos > LONG_MAX - s->step : it->pos < LONG_MIN - s->step) {
+                    it->done = true;
+                } else {
+                    it->pos += s->step;
+                }
+                break;
+            case LSEQ_ITERATE:
+                /* Each step is taken only when its element is asked for. CUR keeps the last one yielded. */
+                if (it->pos++ == 0) {
+                    x = lval_copy(s->seed);
+                } else {
+                    x = lval_apply(it->env, s->fn, lval_add(lval_sexpr(), it->cur));
+                    it->cur = NULL;
+                }
+                if (x->type != LVAL_ERR) it->cur = lval_copy(x);
+                lseq_iter_push(it, x);
+                break;
+            case LSEQ_LIST:
+                if (it->pos >= s->seed->count) {
+                    it->done = true;
+                    break;
+                }
+                lseq_iter_push(it, lval_copy(s->seed->cell[it->pos++]));
+                break;
+            case LSEQ_TAKE:
+                if (it->pos <= 0 || !(x = lseq_iter_next(it->src))) {
+                    it->done = true;
+                    break;
+                }
+                it->pos--;
+                lseq_iter_push(it, x);
+                break;
+            case LSEQ_DROP:
+                while (it->pos > 0 && (x = lseq_iter_next(it->src))) {
+                    it->pos--;
+                    if (x->type == LVAL_ERR) {
+                        it->pos = 0;
+                        lseq_iter_push(it, x);
+                        break;
+                    }
+                    lval_del(x);
+                }
+                if (it->done) break;
+                if (!(x = lseq_iter_next(it->src))) {
+                    it->done = true;
+                    break;
+                }
+                lseq_iter_push(it, x);
+                break;
+            case LSEQ_MAP:
+                if (!(x = lseq_iter_next(it->src))) {
+                    it->done = true;
+                    break;
+                }
+                if (x->type != LVAL_ERR) {
+                    x = lval_apply(it->env, s->fn, lval_add(lval_sexpr(), x));
+                }
+                lseq_iter_push(it, x);
+                break;
+            case LSEQ_FILTER:
+                if (!(x = lseq_iter_next(it->src))) {
+                    it->done = true;
+                    break;
+                }
+                if (x->type == LVAL_ERR) {
+                    lseq_iter_push(it, x);
+                    break;
+                }
+                lval* keep = lval_apply(it->env, s->fn,
+                                        lval_add(lval_sexpr(), lval_copy(x)));
+                if (keep->type == LVAL_ERR) {
+                    lval_del(x);
+                    lseq_iter_push(it, keep);
+                    break;
+                }
+                if (to_bool(keep)) lseq_iter_push(it, x);
+                else lval_del(x);
+                lval_del(keep);
+                break;
+        }
+    }
+}
+
+/* Returns the next element of IT, or NULL once the sequence is exhausted. */
+lval* lseq_iter_next(lseq_iter* it) {
+    if (it->next == it->len) {
+        if (it->done) return NULL;
+        lseq_iter_fill(it);
+        if (it->len == 0) return NULL;
+    }
+    return it->chunk[it->next++];
+}
+
+lval* lseq_realize(lenv* e, lseq* s) {
+    lval* list = lval_qexpr();
+    lseq_iter* it = lseq_iter_new(e, s);
+
+    lval* x;
+    while ((x = lseq_iter_next(it))) {
+        if (x->type == LVAL_ERR) {
+            lval_del(list);
+            list = x;
+            break;
+        }
+        lval_add(list, x);
+    }
+
+    lseq_iter_del(it);
+    return list;
+}
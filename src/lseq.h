@@ -0,0 +1,71 @@
+#ifndef MLISP_LSEQ_H
+#define MLISP_LSEQ_H
+
+#include <stdbool.h>
+
+#include "eval.h"
+
+/*
+ * Lazy sequences are immutable, reference counted recipes. Nothing is
+ * computed until an lseq_iter walks the recipe, and each stage of the
+ * walk only ever holds one chunk of realized values. Chunks are only used
+ * by walks that call no user function: once iterate, lazy-map or
+ * lazy-filter is involved, elements are realized one at a time as they are
+ * asked for, so a function with side effects runs no more often than that.
+ */
+
+#define LSEQ_CHUNK_SIZE 32
+
+typedef enum { LSEQ_RANGE, LSEQ_ITERATE, LSEQ_LIST,
+               LSEQ_TAKE, LSEQ_DROP, LSEQ_MAP, LSEQ_FILTER } lseq_kind_t;
+
+struct lseq {
+    lseq_kind_t kind;
+    int refs;
+
+    long start;
+    long end;
+    long step;
+    bool bounded;
+
+    long n;
+    lval* fn;
+    lval* seed;
+    lseq* src;
+};
+
+typedef struct lseq_iter lseq_iter;
+struct lseq_iter {
+    lseq* seq;
+    lenv* env;
+    lseq_iter* src;
+
+    long pos;
+    lval* cur;
+    bool done;
+
+    int limit;
+    int len;
+    int next;
+    lval* chunk[LSEQ_CHUNK_SIZE];
+};
+
+lseq* lseq_new(lseq_kind_t kind);
+lseq* lseq_range(long start, long end, long step, bool bounded);
+lseq* lseq_iterate(lval* fn, lval* seed);
+lseq* lseq_list(lval* list);
+lseq* lseq_take(lseq* src, long n);
+lseq* lseq_drop(lseq* src, long n);
+lseq* lseq_map(lval* fn, lseq* src);
+lseq* lseq_filter(lval* fn, lseq* src);
+lseq* lseq_of(lval* coll);
+lseq* lseq_ref(lseq* s);
+void lseq_unref(lseq* s);
+
+lseq_iter* lseq_iter_new(lenv* e, lseq* s);
+lval* lseq_iter_next(lseq_iter* it);
+void lseq_iter_del(lseq_iter* it);
+
+lval* lseq_realize(lenv* e, lseq* s);
+
+#endif
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -5,137 +7,319 @@
 
 #include <editline/readline.h>
 
+#include "cache.h"
 #include "eval.h"
+#include "image.h"
 #include "io_utils.h"
 #include "mpc.h"
+#include "output.h"
 #include "parser.h"
+#include "reader.h"
 #include "utils.h"
 
 typedef enum {REPL_CONTINUE, REPL_EXIT} repl_instr_t;
 typedef enum {REPL_VERBOSITY_SILENT, REPL_VERBOSITY_NORMAL} repl_verbosity_t;
-
-int MAX_INIT_FILE_SIZE = 10000;
+typedef enum {READER_NATIVE, READER_MPC} reader_mode_t;
 
 char* EXIT_INPUTS[] = {"exit", "quit", "(exit)", "(quit)"};
 
-repl_instr_t eval_input(parser_t* parser, lenv* e, char* input, repl_verbosity_t v) {
-    add_history(input);
+typedef struct {
+    reader_mode_t reader;
+    bool no_init;
+    bool cache;
+    bool batch;
+    char* init_file;
+    char* image;
+    char* dump_image;
+    int first_file;
+} options_t;
+
+options_t OPTIONS = {READER_NATIVE, false, false, false, NULL, NULL, NULL, 1};
+
+/*
+ * resources/init.el, already evaluated: the Makefile runs it through a
+ * stage0 build of mlisp and embeds the image of the environment it leaves.
+ * Replaced by --init FILE, skipped with --no-init. The stage0 build has no
+ * prelude of its own and is only ever run with --no-init.
+ */
+#ifndef MLISP_STAGE0
+static const unsigned char PRELUDE_IMAGE[] = {
+#include "prelude.img.inc"
+};
+#endif
+
+/* Reads every form in the LENGTH bytes at INPUT into an S-Expression, or an error value for a syntax error. */
+lval* read_chunk(parser_t* parser, const char* input, size_t length) {
+    if (OPTIONS.reader == READER_NATIVE) return reader_read(input, length);
+
+    mpc_result_t result;
+    if (!parser_parse(parser, input, length, &result)) {
+        char* msg = mpc_err_string(result.error);
+        mpc_err_delete(result.error);
+        size_t n = strlen(msg);
+        if (n && msg[n - 1] == '\n') msg[n - 1] = '\0';
+        /* Taken over whole, as lval_err would cut a long list of expected inputs short. */
+        lval* err = lval_err("");
+        free(err->err);
+        err->err = msg;
+        return err;
+    }
 
+    mpc_ast_t* ast = result.output;
+    lval* x = lval_read(ast);
+    mpc_ast_delete(ast);
+    return x;
+}
+
+/* As read_chunk, but syntax errors are printed and give NULL. */
+lval* read_input(parser_t* parser, const char* input, size_t length) {
+    lval* x = read_chunk(parser, input, length);
+    if (x->type == LVAL_ERR) {
+        lval_println(NULL, x, false);
+        lval_del(x);
+        return NULL;
+    }
+    return x;
+}
+
+repl_instr_t eval_input(parser_t* parser, lenv* e, const char* input, size_t length, repl_verbosity_t v) {
     for (int i=0; i < ARRAY_LENGTH(EXIT_INPUTS); i++) {
-        if (strcmp(input, EXIT_INPUTS[i]) == 0) {
+        if (strlen(EXIT_INPUTS[i]) == length && memcmp(input, EXIT_INPUTS[i], length) == 0) {
             return REPL_EXIT;
         }
     }
 
-    mpc_result_t result;
-    int rc = parser_parse(parser, input, &result);
-    if (rc) {
-        mpc_ast_t* ast = result.output;
-        lval* x = eval(e, ast);
+    lval* forms = read_input(parser, input, length);
+    if (forms) {
+        lval* x = lval_eval(e, forms, 0);
         if (v != REPL_VERBOSITY_SILENT) lval_println(e, x, false);
         lval_del(x);
-        mpc_ast_delete(ast);
-    } else {
-        mpc_err_print(result.error);
-        mpc_err_delete(result.error);
     }
 
     return REPL_CONTINUE;
 }
 
-bool is_all_spaces(char* s) {
-    for (int i=0; i < strlen(s); i++) {
-        if (!isspace(s[i])) return false;
-    }
-    return true;
-}
-
 repl_instr_t eval_all_sexpr_in_string(lenv* e, parser_t* parser, char* input, repl_verbosity_t v) {
-    int opened = 0;
-    int closed = 0;
-
-    char buffer[1000];
-    buffer[0] = '\0';
-    int bi = 0;
+    size_t length = strlen(input);
+    size_t pos = 0;
+    reader_span span;
     int rc = REPL_CONTINUE;
+    while (reader_next_span(input, length, &pos, &span)) {
+        rc = eval_input(parser, e, span.start, span.length, v);
+    }
+    return rc;
+}
 
-    for(int i=0; i < strlen(input); i++) {
-        char c = input[i];
-        if (isspace(c) && opened == closed) continue;
-
-        if (c == ';') {
-            while (c != '\r' && c != '\n') {
-                i++;
-                c = input[i];
-            }
-            continue;
-        }
-
-        buffer[bi++] = c;
-
-        if (c == '(') opened++;
-        else if (c == ')') closed++;
+/* Returns a global environment holding the builtins and the prelude's bindings. */
+lenv* load_prelude(void) {
+#ifndef MLISP_STAGE0
+    lenv* prelude = image_load_bytes(PRELUDE_IMAGE, sizeof(PRELUDE_IMAGE));
+    if (prelude) return prelude;
+    output_str("Error loading the prelude image\n");
+#endif
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+    return e;
+}
 
-        if (opened && (opened == closed)) {
-            buffer[bi] = '\0';
-            rc = eval_input(parser, e, buffer, v);
-            bi = 0;
-            buffer[0] = '\0';
+/*
+ * Reads every top-level chunk of the LENGTH bytes at DATA into FORMS, one
+ * S-Expression per chunk. The native reader is pure, so it reads the chunks
+ * of a large file in parallel. A chunk with a syntax error is kept as its
+ * error value, so it can be reported in its place when FORMS is evaluated.
+ * Returns false if any chunk had a syntax error.
+ */
+bool read_chunks(parser_t* parser, const char* data, size_t length, lval* forms) {
+    size_t pos = 0;
+    reader_span span;
+    reader_span* spans = NULL;
+    long count = 0, capacity = 0;
+    while (reader_next_span(data, length, &pos, &span)) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            spans = realloc(spans, sizeof(reader_span) * capacity);
         }
+        spans[count++] = span;
     }
-    buffer[bi] = '\0';
 
-    if (strlen(buffer)) {
-        rc = eval_input(parser, e, buffer, v);
+    forms->cell = malloc(sizeof(lval*) * (count ? count : 1));
+    forms->count = count;
+    if (OPTIONS.reader == READER_NATIVE) {
+        reader_read_spans(spans, count, forms->cell);
+    } else {
+        for (long i=0; i < count; i++) forms->cell[i] = read_chunk(parser, spans[i].start, spans[i].length);
     }
+    free(spans);
 
-    return rc;
+    bool ok = true;
+    for (long i=0; i < count; i++) {
+        if (forms->cell[i]->type == LVAL_ERR) ok = false;
+    }
+    return ok;
 }
 
-
+/*
+ * Reads and evaluates the file at FILE_PATH. With --cache, what it reads
+ * to, one S-Expression per top-level chunk, is cached by content hash and
+ * reader, so an unchanged file is evaluated without being read again.
+ */
 void load_file(lenv* e, parser_t* parser, char* file_path) {
-    char* buffer = read_file(file_path);
-    eval_all_sexpr_in_string(e, parser, buffer, REPL_VERBOSITY_SILENT);
-    free(buffer);
+    mapped_file file;
+    if (!map_file(file_path, &file)) return;
+
+    lval* forms = OPTIONS.cache ? cache_lookup(file.data, file.length, OPTIONS.reader) : NULL;
+    if (!forms) {
+        forms = lval_qexpr();
+        bool ok = read_chunks(parser, file.data, file.length, forms);
+        if (ok && OPTIONS.cache) cache_store(file.data, file.length, OPTIONS.reader, forms);
+    }
+    unmap_file(&file);
+
+    for (int i=0; i < forms->count; i++) {
+        lval* x = forms->cell[i];
+        if (x->type == LVAL_ERR) {
+            lval_println(NULL, x, false);
+            lval_del(x);
+            continue;
+        }
+        lval_del(lval_eval(e, x, 0));
+    }
+    forms->count = 0;
+    lval_del(forms);
 }
 
+/* Lines are fed to a reader_stream, so a form typed or pasted over several lines is evaluated once, when it closes. */
 void repl(parser_t* parser, lenv* e) {
-    while(1) {
-        char* input = readline("mlisp> ");
+    reader_stream s;
+    reader_stream_init(&s);
+    reader_span span;
+    repl_instr_t rc = REPL_CONTINUE;
+    while (rc != REPL_EXIT) {
+        output_flush();
+        char* input = readline(reader_stream_pending(&s) ? "  ...> " : "mlisp> ");
         if (input == NULL) {
+            if (reader_stream_end(&s, &span)) eval_input(parser, e, span.start, span.length, REPL_VERBOSITY_NORMAL);
             break;
         }
-        repl_instr_t rc = eval_all_sexpr_in_string(e, parser, input, REPL_VERBOSITY_NORMAL);
+        if (*input) add_history(input);
+        reader_stream_feed_line(&s, input, strlen(input));
         free(input);
-        if (rc == REPL_EXIT) break;
+        while (rc != REPL_EXIT && reader_stream_next(&s, &span)) {
+            rc = eval_input(parser, e, span.start, span.length, REPL_VERBOSITY_NORMAL);
+        }
     }
+    reader_stream_free(&s);
     lenv_del(e);
-    puts("\nGoodbye!");
+    output_str("\nGoodbye!\n");
+}
+
+/*
+ * Evaluates the forms piped to stdin as they arrive, for --batch. There is
+ * no prompt, no readline, no history and no echo of results, just as when
+ * loading a file.
+ */
+void batch(parser_t* parser, lenv* e) {
+    reader_stream s;
+    reader_stream_init(&s);
+    reader_span span;
+    repl_instr_t rc = REPL_CONTINUE;
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t n;
+    while (rc != REPL_EXIT && (n = getline(&line, &capacity, stdin)) >= 0) {
+        if (n && line[n - 1] == '\n') n--;
+        reader_stream_feed_line(&s, line, n);
+        while (rc != REPL_EXIT && reader_stream_next(&s, &span)) {
+            rc = eval_input(parser, e, span.start, span.length, REPL_VERBOSITY_SILENT);
+        }
+    }
+    if (rc != REPL_EXIT && reader_stream_end(&s, &span)) {
+        eval_input(parser, e, span.start, span.length, REPL_VERBOSITY_SILENT);
+    }
+    free(line);
+    reader_stream_free(&s);
+}
+
+/* Prints how well mpc's input pools served the parses of this run, for --mpc-stats. */
+void print_mpc_stats(void) {
+    mpc_mem_stats_t s;
+    mpc_mem_stats(&s);
+    unsigned long total = s.hits + s.fallbacks;
+    fprintf(stderr, "mpc pool: %lu hits, %lu fallbacks (%.2f%%), %lu chunks\n",
+            s.hits, s.fallbacks, total ? 100.0 * s.fallbacks / total : 0.0, s.chunks);
+}
+
+/* Reads the leading --options into OPTIONS. The remaining arguments are files to load. */
+bool parse_options(int argc, char** argv) {
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--mpc-parser") == 0) {
+            OPTIONS.reader = READER_MPC;
+        } else if (strcmp(argv[i], "--mpc-stats") == 0) {
+            atexit(print_mpc_stats);
+        } else if (strcmp(argv[i], "--no-init") == 0) {
+            OPTIONS.no_init = true;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            OPTIONS.cache = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            OPTIONS.cache = false;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            OPTIONS.batch = true;
+        } else if (strcmp(argv[i], "--init") == 0 && i + 1 < argc) {
+            OPTIONS.init_file = argv[++i];
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            OPTIONS.image = argv[++i];
+        } else if (strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc) {
+            OPTIONS.dump_image = argv[++i];
+        } else {
+            output_format("Unknown option %s\n", argv[i]);
+            return false;
+        }
+    }
+    OPTIONS.first_file = i;
+    return true;
 }
 
 int main(int argc, char** argv) {
-    parser_t* parser = parser_build();
-    if (!parser) {
-        printf("Error loading lisp parser.");
+    if (!parse_options(argc, argv)) return 1;
+
+    /* Only the mpc path needs a parser; the native reader has no setup cost. */
+    parser_t* parser = NULL;
+    if (OPTIONS.reader == READER_MPC && !(parser = parser_build())) {
+        output_str("Error loading lisp parser.\n");
         return 1;
     }
 
-    lenv* e = lenv_new();
-    lenv_add_builtins(e);
-    load_file(e, parser, "resources/init.el");
+    /* An image already holds the prelude and whatever files were loaded when it was dumped. */
+    lenv* e;
+    if (OPTIONS.image) {
+        if (!(e = image_load(OPTIONS.image))) return 1;
+    } else if (OPTIONS.init_file || OPTIONS.no_init) {
+        e = lenv_new();
+        lenv_add_builtins(e);
+        if (OPTIONS.init_file) load_file(e, parser, OPTIONS.init_file);
+    } else {
+        e = load_prelude();
+    }
 
-    if (argc > 1) {
-        for (int i=1; i < argc; i++) {
-            load_file(e, parser, argv[i]);
-        }
+    for (int i=OPTIONS.first_file; i < argc; i++) {
+        load_file(e, parser, argv[i]);
+    }
+    if (OPTIONS.batch) batch(parser, e);
+    if (OPTIONS.dump_image) {
+        return image_dump(e, OPTIONS.dump_image) ? 0 : 1;
+    }
+
+    if (OPTIONS.first_file < argc) {
         eval_all_sexpr_in_string(e, parser, "(main)", REPL_VERBOSITY_SILENT);
         return 0;
     }
+    if (OPTIONS.batch) return 0;
 
-    puts(" MLISP Version 0.0.0.0.1");
-    puts(" Press Ctrl + c to Exit\n");
+    output_str(" MLISP Version 0.0.0.0.1\n");
+    output_str(" Press Ctrl + c to Exit\n\n");
     repl(parser, e);
-    parser_cleanup(parser);
+    if (parser) parser_cleanup(parser);
 
     return 0;
 }
@@ -20,6 +20,145 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+/*
+** AST Arena
+**
+** The ASTs built by mpca_lang grammars are allocated from one arena per
+** parse. Nodes, contents and children arrays are bumped out of a few large
+** chunks, and tags are interned so that each distinct tag is stored once
+** and equal tags are the same pointer. The finished tree's root owns the
+** arena: deleting the root frees everything at once, and deleting any other
+** node of the tree does nothing. Heap nodes added to an arena tree by hand
+** are still freed along with it.
+*/
+
+enum {
+  MPC_ARENA_CHUNK_MIN = 4096,
+  MPC_ARENA_CHUNK_MAX = 1 << 22,
+  MPC_ARENA_TAGS_MIN  = 64
+};
+
+typedef union mpc_arena_chunk_t {
+  union mpc_arena_chunk_t *next;
+  long align_long;
+  double align_double;
+  void *align_ptr;
+} mpc_arena_chunk_t;
+
+typedef struct mpc_arena_t {
+  mpc_arena_chunk_t *chunks;
+  char *next;
+  char *end;
+  size_t chunk_size;
+  mpc_ast_t *root;
+  int foreign;
+  int tags_num;
+  int tags_slots;
+  char **tags;
+} mpc_arena_t;
+
+static mpc_arena_t *mpc_arena_new(void) {
+  mpc_arena_t *m = calloc(1, sizeof(mpc_arena_t));
+  m->chunk_size = MPC_ARENA_CHUNK_MIN;
+  return m;
+}
+
+static void mpc_arena_delete(mpc_arena_t *m) {
+  mpc_arena_chunk_t *c, *n;
+  for (c = m->chunks; c; c = n) { n = c->next; free(c); }
+  free(m->tags);
+  free(m);
+}
+
+static void *mpc_arena_alloc(mpc_arena_t *m, size_t n) {
+
+  mpc_arena_chunk_t *c;
+  size_t size;
+  char *x;
+
+  n = (n + sizeof(mpc_arena_chunk_t) - 1) / sizeof(mpc_arena_chunk_t) * sizeof(mpc_arena_chunk_t);
+
+  if ((size_t)(m->end - m->next) < n) {
+    size = n > m->chunk_size ? n : m->chunk_size;
+    if (m->chunk_size < MPC_ARENA_CHUNK_MAX) { m->chunk_size *= 2; }
+    c = malloc(sizeof(mpc_arena_chunk_t) + size);
+    c->next = m->chunks;
+    m->chunks = c;
+    m->next = (char*)(c + 1);
+    m->end = m->next + size;
+  }
+
+  x = m->next;
+  m->next += n;
+  return x;
+}
+
+static unsigned long mpc_arena_hash(unsigned long h, const char *s, size_t n) {
+  size_t j;
+  for (j = 0; j < n; j++) { h = (h ^ (unsigned char)s[j]) * 16777619ul; }
+  return h;
+}
+
+/*
+** Interns the tag made of the first XN bytes of X followed by Y and Z, so
+** that tags can be prefixed without building the new string first.
+*/
+
+static char *mpc_arena_tag(mpc_arena_t *m, const char *x, size_t xn, const char *y, const char *z) {
+
+  int j, slots;
+  char **tags, *t;
+  size_t yn = strlen(y), zn = strlen(z);
+  unsigned long h = 2166136261ul;
+
+  if (m->tags_num * 2 >= m->tags_slots) {
+    slots = m->tags_slots ? m->tags_slots * 2 : MPC_ARENA_TAGS_MIN;
+    tags = calloc(slots, sizeof(char*));
+    for (j = 0; j < m->tags_slots; j++) {
+      if (!m->tags[j]) { continue; }
+      h = mpc_arena_hash(2166136261ul, m->tags[j], strlen(m->tags[j]));
+      while (tags[h & (slots - 1)]) { h++; }
+      tags[h & (slots - 1)] = m->tags[j];
+    }
+    free(m->tags);
+    m->tags = tags;
+    m->tags_slots = slots;
+    h = 2166136261ul;
+  }
+
+  h = mpc_arena_hash(mpc_arena_hash(mpc_arena_hash(h, x, xn), y, yn), z, zn);
+
+  for (;; h++) {
+    t = m->tags[h & (m->tags_slots - 1)];
+    if (!t) { break; }
+    if (strlen(t) == xn + yn + zn
+    && memcmp(t, x, xn) == 0
+    && memcmp(t + xn, y, yn) == 0
+    && memcmp(t + xn + yn, z, zn) == 0) { return t; }
+  }
+
+  t = mpc_arena_alloc(m, xn + yn + zn + 1);
+  memcpy(t, x, xn);
+  memcpy(t + xn, y, yn);
+  memcpy(t + xn + yn, z, zn + 1);
+  m->tags[h & (m->tags_slots - 1)] = t;
+  m->tags_num++;
+  return t;
+}
+
+static mpc_ast_t *mpc_arena_ast(mpc_arena_t *m, const char *tag, const char *contents) {
+  size_t n = strlen(contents);
+  mpc_ast_t *a = mpc_arena_alloc(m, sizeof(mpc_ast_t));
+  a->tag = mpc_arena_tag(m, tag, strlen(tag), "", "");
+  a->contents = mpc_arena_alloc(m, n + 1);
+  memcpy(a->contents, contents, n + 1);
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  a->arena = m;
+  return a;
+}
+
 /*
 ** Input Type
 */
@@ -65,21 +204,58 @@ enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/*
+** Each input has a pool for the small values built while parsing. Sizes
+** are rounded up to one of a few classes, each with its own free list, and
+** new blocks are cut from chunks: first one held in the input itself, then
+** heap chunks that double in size as the parse needs them. Only requests
+** above the largest class go to malloc. Every block has a header word with
+** its class in front of it, and pool blocks are told from heap ones by the
+** chunk they fall in.
+*/
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_MEM_NUM = 4096,
+  MPC_MEM_CLASSES   = 10,
+  MPC_MEM_CLASS_MAX = 512,
+  MPC_MEM_CHUNK_MIN = 1 << 16,
+  MPC_MEM_CHUNK_MAX = 1 << 22
 };
 
-typedef struct {
-  char mem[64];
+/* Class sizes step by about half, so a block wastes at most a third of itself. */
+static const unsigned short mpc_mem_class_size[MPC_MEM_CLASSES] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+
+/* The class for a size, indexed by the size in 16 byte units, rounded up. */
+static const unsigned char mpc_mem_class[MPC_MEM_CLASS_MAX / 16 + 1] = {
+  0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+  8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9
+};
+
+typedef union mpc_mem_t {
+  union mpc_mem_t *next;
+  long cls;
+  double align_double;
+  void *align_ptr;
 } mpc_mem_t;
 
+typedef struct mpc_mem_chunk_t {
+  struct mpc_mem_chunk_t *next;
+  char *end;
+  mpc_mem_t first;
+} mpc_mem_chunk_t;
+
+static mpc_mem_stats_t mpc_mem_totals;
+
 typedef struct {
 
   int type;
   char *filename;
   mpc_state_t state;
 
-  char *string;
+  const char *string;
+  long length;
   char *buffer;
   FILE *file;
 
@@ -92,12 +268,28 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
+  char *mem_next;
+  char *mem_end;
+  size_t mem_chunk_size;
+  mpc_mem_chunk_t *mem_chunks;
+  mpc_mem_t *mem_free[MPC_MEM_CLASSES];
+  mpc_mem_stats_t mem_stats;
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
+  mpc_arena_t *arena;
+
+  struct mpc_frame_t **frames;
+  int frames_segs;
+  long frames_num;
+
 } mpc_input_t;
 
+/*
+** String inputs borrow the caller's buffer rather than copying it. Every
+** parse finishes before mpc_parse returns and results never point into the
+** input, so the buffer only has to outlive the call.
+*/
+
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -108,8 +300,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = strlen(string);
   i->buffer = NULL;
   i->file = NULL;
 
@@ -121,8 +313,18 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_next = (char*)i->mem;
+  i->mem_end = (char*)(i->mem + MPC_INPUT_MEM_NUM);
+  i->mem_chunk_size = MPC_MEM_CHUNK_MIN;
+  i->mem_chunks = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  memset(&i->mem_stats, 0, sizeof(mpc_mem_stats_t));
+
+  i->arena = NULL;
+
+  i->frames = NULL;
+  i->frames_segs = 0;
+  i->frames_num = 0;
 
   return i;
 }
@@ -137,9 +339,8 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->state = mpc_state_new();
 
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
   i->file = NULL;
 
@@ -151,8 +352,18 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_next = (char*)i->mem;
+  i->mem_end = (char*)(i->mem + MPC_INPUT_MEM_NUM);
+  i->mem_chunk_size = MPC_MEM_CHUNK_MIN;
+  i->mem_chunks = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  memset(&i->mem_stats, 0, sizeof(mpc_mem_stats_t));
+
+  i->arena = NULL;
+
+  i->frames = NULL;
+  i->frames_segs = 0;
+  i->frames_num = 0;
 
   return i;
 
@@ -169,6 +380,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
 
@@ -180,8 +392,18 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_next = (char*)i->mem;
+  i->mem_end = (char*)(i->mem + MPC_INPUT_MEM_NUM);
+  i->mem_chunk_size = MPC_MEM_CHUNK_MIN;
+  i->mem_chunks = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  memset(&i->mem_stats, 0, sizeof(mpc_mem_stats_t));
+
+  i->arena = NULL;
+
+  i->frames = NULL;
+  i->frames_segs = 0;
+  i->frames_num = 0;
 
   return i;
 
@@ -197,6 +419,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
 
@@ -208,17 +431,39 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_next = (char*)i->mem;
+  i->mem_end = (char*)(i->mem + MPC_INPUT_MEM_NUM);
+  i->mem_chunk_size = MPC_MEM_CHUNK_MIN;
+  i->mem_chunks = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  memset(&i->mem_stats, 0, sizeof(mpc_mem_stats_t));
+
+  i->arena = NULL;
+
+  i->frames = NULL;
+  i->frames_segs = 0;
+  i->frames_num = 0;
 
   return i;
 }
 
 static void mpc_input_delete(mpc_input_t *i) {
 
+  int j;
+  mpc_mem_chunk_t *c, *n;
+
   free(i->filename);
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+  if (i->arena) { mpc_arena_delete(i->arena); }
+
+  for (j = 0; j < i->frames_segs; j++) { free(i->frames[j]); }
+  free(i->frames);
+
+  for (c = i->mem_chunks; c; c = n) { n = c->next; free(c); }
+  mpc_mem_totals.hits      += i->mem_stats.hits;
+  mpc_mem_totals.fallbacks += i->mem_stats.fallbacks;
+  mpc_mem_totals.chunks    += i->mem_stats.chunks;
+
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
 
   free(i->marks);
@@ -227,29 +472,56 @@ static void mpc_input_delete(mpc_input_t *i) {
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  mpc_mem_chunk_t *c;
+  if ((char*)p >= (char*)i->mem && (char*)p < (char*)(i->mem + MPC_INPUT_MEM_NUM)) { return 1; }
+  for (c = i->mem_chunks; c; c = c->next) {
+    if ((char*)p > (char*)c && (char*)p < c->end) { return 1; }
+  }
+  return 0;
+}
+
+static size_t mpc_mem_size(void *p) {
+  return mpc_mem_class_size[((mpc_mem_t*)p - 1)->cls];
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  int c;
+  size_t size;
+  mpc_mem_t *b;
+  mpc_mem_chunk_t *k;
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (n > MPC_MEM_CLASS_MAX) {
+    i->mem_stats.fallbacks++;
+    return malloc(n);
+  }
 
-  return malloc(n);
+  i->mem_stats.hits++;
+  c = mpc_mem_class[(n + 15) / 16];
+
+  if (i->mem_free[c]) {
+    b = i->mem_free[c];
+    i->mem_free[c] = b->next;
+    return b;
+  }
+
+  size = sizeof(mpc_mem_t) + mpc_mem_class_size[c];
+
+  if ((size_t)(i->mem_end - i->mem_next) < size) {
+    k = malloc(sizeof(mpc_mem_chunk_t) + i->mem_chunk_size);
+    k->next = i->mem_chunks;
+    k->end = (char*)&k->first + i->mem_chunk_size;
+    i->mem_chunks = k;
+    i->mem_next = (char*)&k->first;
+    i->mem_end = k->end;
+    i->mem_stats.chunks++;
+    if (i->mem_chunk_size < MPC_MEM_CHUNK_MAX) { i->mem_chunk_size *= 2; }
+  }
+
+  b = (mpc_mem_t*)i->mem_next;
+  b->cls = c;
+  i->mem_next += size;
+  return b + 1;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,37 +531,39 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  mpc_mem_t *b = p;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  b->next = i->mem_free[(b - 1)->cls];
+  i->mem_free[(b - 1)->cls] = b;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   char *q = NULL;
 
+  if (p == NULL) { return mpc_malloc(i, n); }
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (n <= mpc_mem_size(p)) { return p; }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
-  }
-
-  return p;
+  q = mpc_malloc(i, n);
+  memcpy(q, p, mpc_mem_size(p));
+  mpc_free(i, p);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  q = malloc(mpc_mem_size(p));
+  memcpy(q, p, mpc_mem_size(p));
   mpc_free(i, p);
   return q;
 }
 
+void mpc_mem_stats(mpc_mem_stats_t *s) {
+  *s = mpc_mem_totals;
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -362,7 +636,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -374,7 +648,7 @@ static char mpc_input_getc(mpc_input_t *i) {
 
   switch (i->type) {
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
 
@@ -397,7 +671,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
 
       c = fgetc(i->file);
@@ -882,7 +1156,9 @@ enum {
   MPC_TYPE_COUNT     = 22,
 
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+
+  MPC_TYPE_DFA       = 25
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -898,8 +1174,9 @@ typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_t
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; int dispatch; struct mpc_or_table_t *table; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { struct mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -917,6 +1194,7 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -924,6 +1202,8 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  char arena;
+  char flat;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -976,7 +1256,7 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->arena ? mpc_arena_ast(i->arena, "", c) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
@@ -996,22 +1276,531 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Parsers are run by a loop over an explicit stack of frames rather than
+** by recursion, so how deeply they nest is limited only by memory. A frame
+** is one call of a parser that runs others. When it asks for a child the
+** loop runs the child and then resumes the frame with the result, which is
+** passed back in the caller's mpc_result_t. Parsers that cannot reach a
+** retained parser are run by plain recursion instead, see mpc_parse_flat.
+**
+** The stack belongs to the input and is kept in segments that never move,
+** so frames can hand children pointers to their own fields.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_PARSE_STACK_MIN = 4,
+  MPC_FRAMES_SEG      = 256
 };
 
+typedef struct mpc_frame_t {
+  mpc_parser_t *p;
+  mpc_err_t **e;
+  char phase;
+  int j, k, m;
+  int slots;
+  mpc_result_t *results;
+  mpc_result_t stk[MPC_PARSE_STACK_MIN];
+  mpc_err_t *side;
+  mpc_state_t start;
+  char *run;
+} mpc_frame_t;
+
+static mpc_frame_t *mpc_frame_push(mpc_input_t *i, mpc_parser_t *p, mpc_err_t **e) {
+  mpc_frame_t *f;
+  long n = i->frames_num++;
+  if (n / MPC_FRAMES_SEG == i->frames_segs) {
+    i->frames = realloc(i->frames, sizeof(mpc_frame_t*) * (i->frames_segs + 1));
+    i->frames[i->frames_segs++] = malloc(sizeof(mpc_frame_t) * MPC_FRAMES_SEG);
+  }
+  f = &i->frames[n / MPC_FRAMES_SEG][n % MPC_FRAMES_SEG];
+  f->p = p;
+  f->e = e;
+  f->phase = 0;
+  return f;
+}
+
+static mpc_frame_t *mpc_frame_top(mpc_input_t *i) {
+  long n = i->frames_num - 1;
+  return &i->frames[n / MPC_FRAMES_SEG][n % MPC_FRAMES_SEG];
+}
+
+static void mpc_frame_pop(mpc_input_t *i) { i->frames_num--; }
+
+static void mpc_frame_add(mpc_input_t *i, mpc_frame_t *f, mpc_result_t *r) {
+  if (f->j == f->slots) {
+    f->slots = f->j + f->j / 2;
+    if (f->results == f->stk) {
+      f->results = mpc_malloc(i, sizeof(mpc_result_t) * f->slots);
+      memcpy(f->results, f->stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+    } else {
+      f->results = mpc_realloc(i, f->results, sizeof(mpc_result_t) * f->slots);
+    }
+  }
+  f->results[f->j++] = *r;
+}
+
+static void mpc_frame_free(mpc_input_t *i, mpc_frame_t *f) {
+  if (f->results != f->stk) { mpc_free(i, f->results); }
+}
+
+/*
+** Parsers and frame steps return 1 on success and 0 on failure, with the
+** result in R, or -1 after naming in Q and QE a child to run and where its
+** errors go.
+*/
+
 #define MPC_SUCCESS(x) r->output = x; return 1
 #define MPC_FAILURE(x) r->error = x; return 0
 #define MPC_PRIMITIVE(x) \
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
+#define MPC_CALL(c, s) *q = c; *qe = s; return -1
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+static int mpc_parse_dfa(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+/* Copies an error onto the heap, outside the input's pool, so it can outlive the current parse step. */
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = malloc(sizeof(mpc_err_t));
+  *y = *x;
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  return y;
+}
+
+/*
+** Regex DFAs
+**
+** mpc_re compiles a regex to a table when every choice and loop in it can
+** be decided by the next byte alone (see mpc_re_dfa). Bytes are grouped
+** into classes that every character set in the regex treats alike, and the
+** last class stands for the end of input. Each (state, class) cell holds
+** ACCEPT, REJECT, or the offset of the next state's row shifted left once,
+** with the low bit set if the cell records errors.
+**
+** The combinator tree is kept. The errors it reports depend only on the
+** cells a match passes through, so the first time an error recording cell
+** is used while errors are live the tree is run instead and its errors are
+** stored against the cell, then rebuilt from there on later matches. If
+** the tree ever disagrees with the table, error reporting parses go back
+** to the tree.
+*/
+
+enum {
+  MPC_DFA_ACCEPT     = -1,
+  MPC_DFA_REJECT     = -2,
+  MPC_DFA_MAX_STATES = 256
+};
+
+typedef struct {
+  char has_side;
+  char has_error;
+  mpc_err_t *side;
+  mpc_err_t *error;
+} mpc_dfa_errs_t;
+
+struct mpc_dfa_t {
+  int classes;
+  int states;
+  unsigned char cls[256];
+  int *move;
+  char *side;
+  mpc_dfa_errs_t *errs;
+  int exact;
+};
+
+typedef struct mpc_dfa_t mpc_dfa_t;
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  for (j = 0; j < d->states * d->classes; j++) {
+    if (d->errs[j].side) { mpc_err_delete(d->errs[j].side); }
+    if (d->errs[j].error) { mpc_err_delete(d->errs[j].error); }
+  }
+  free(d->move);
+  free(d->side);
+  free(d->errs);
+  free(d);
+}
+
+/* Moves ST forward to TO, counting rows and columns as mpc_input_success does. */
+static void mpc_dfa_advance(mpc_state_t *st, const char *s, long to) {
+  const char *x = s + st->pos, *end = s + to, *nl;
+  while ((nl = memchr(x, '\n', end - x)) != NULL) {
+    st->col = 0;
+    st->row++;
+    x = nl + 1;
+  }
+  st->col += end - x;
+  st->pos = to;
+}
+
+/* Rebuilds a stored error for position POS of the match starting at the input's state. */
+static mpc_err_t *mpc_dfa_err(mpc_input_t *i, mpc_err_t *x, long pos) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  y->state = i->state;
+  mpc_dfa_advance(&y->state, i->string, pos);
+  y->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  strcpy(y->filename, i->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  y->recieved = pos < i->length ? i->string[pos] : '\0';
+  return y;
+}
+
+/*
+** Stores what a run of the tree reported against the cells the table
+** used for the same match: the final cell T, and SIDE_T, the last cell
+** that records errors, reached at SIDE_AT.
+*/
+
+static void mpc_dfa_learn(mpc_dfa_t *d, int x, long end, long q, long t, long side_at, long side_t, mpc_err_t *error, mpc_err_t *side) {
+
+  if (x != (d->move[t] == MPC_DFA_ACCEPT)
+  || (x && end != q)
+  || (!x && error && error->state.pos != q)
+  || (side_at <  0 && side != NULL)
+  || (side_at >= 0 && (side == NULL || side->state.pos != side_at))) {
+    d->exact = 0;
+    return;
+  }
+
+  if (!x && !d->errs[t].has_error) {
+    d->errs[t].error = mpc_err_copy(error);
+    d->errs[t].has_error = 1;
+  }
+
+  if (side_at >= 0 && !d->errs[side_t].has_side) {
+    d->errs[side_t].side = mpc_err_copy(side);
+    d->errs[side_t].has_side = 1;
+  }
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+
+  mpc_dfa_t *d = p->data.dfa.d;
+  const unsigned char *s = (const unsigned char*)i->string;
+  long start, q, t, side_at = -1, side_t = 0, j, k;
+  int row = 0, move, x;
+  mpc_err_t *side = NULL;
+  char *out;
+
+  if (i->type != MPC_INPUT_STRING || i->backtrack < 1 || (!i->suppress && !d->exact)) {
+    return mpc_parse_run(i, p->data.dfa.x, r, e);
+  }
+
+  start = q = i->state.pos;
+  while (1) {
+    t = row + (q < i->length ? d->cls[s[q]] : d->classes - 1);
+    move = d->move[t];
+    if (move < 0) { break; }
+    if (move & 1) { side_at = q; side_t = t; }
+    row = move >> 1;
+    q++;
+  }
+  if (d->side[t]) { side_at = q; side_t = t; }
+
+  if (!i->suppress
+  && ((move == MPC_DFA_REJECT && !d->errs[t].has_error)
+  ||  (side_at >= 0 && !d->errs[side_t].has_side))) {
+    x = mpc_parse_run(i, p->data.dfa.x, r, &side);
+    mpc_dfa_learn(d, x, i->state.pos, q, t, side_at, side_t, x ? NULL : r->error, side);
+    if (side) { *e = mpc_err_merge(i, *e, side); }
+    return x;
+  }
+
+  if (!i->suppress && side_at >= 0) {
+    *e = mpc_err_merge(i, *e, mpc_dfa_err(i, d->errs[side_t].side, side_at));
+  }
+
+  if (move == MPC_DFA_REJECT) {
+    r->error = i->suppress ? NULL : mpc_dfa_err(i, d->errs[t].error, q);
+    return 0;
+  }
+
+  /* Characters are folded with strcat in the tree, which drops any NUL bytes */
+  out = mpc_malloc(i, q - start + 1);
+  if (memchr(s + start, '\0', q - start) == NULL) {
+    memcpy(out, s + start, q - start);
+    out[q - start] = '\0';
+  } else {
+    for (j = start, k = 0; j < q; j++) {
+      if (s[j]) { out[k++] = s[j]; }
+    }
+    out[k] = '\0';
+  }
+
+  if (q > start) { i->last = s[q-1]; }
+  mpc_dfa_advance(&i->state, i->string, q);
+  r->output = out;
+  return 1;
+}
+
+/*
+** First Character Dispatch
+**
+** mpc_optimise marks each `or` for dispatch. The first time one runs on a
+** string input its table is built: for every byte, and for the end of
+** input, which alternatives could get anywhere. An alternative that cannot
+** match the empty string and whose FIRST set lacks the next byte must fail
+** right there, so it is not run. Alternatives whose outcome may depend on
+** more than the next byte, through `not` or anchors, are always run.
+**
+** Skipped alternatives still report errors. Every error of a run of them
+** sits at the current position, so the first time a run is skipped with
+** errors live it is run instead and its merged error stored against the
+** byte, then rebuilt from there on later skips. If a skipped alternative
+** ever succeeds or reports an error elsewhere it is no longer skipped on
+** that byte.
+*/
+
+enum {
+  MPC_FIRST_NULLABLE = 1,
+  MPC_FIRST_INEXACT  = 2,
+  MPC_FIRST_STEPS    = 4096
+};
+
+typedef struct {
+  char has;
+  mpc_err_t *error;
+} mpc_or_errs_t;
+
+struct mpc_or_table_t {
+  int n;
+  char *run;
+  mpc_or_errs_t *errs;
+};
+
+typedef struct mpc_or_table_t mpc_or_table_t;
+
+static void mpc_or_table_delete(mpc_or_table_t *t) {
+  int j;
+  if (t == NULL) { return; }
+  for (j = 0; j < t->n * 257; j++) {
+    if (t->errs[j].error) { mpc_err_delete(t->errs[j].error); }
+  }
+  free(t->run);
+  free(t->errs);
+  free(t);
+}
+
+/* Adds the bytes P can start with to SET. Returns MPC_FIRST flags, giving up when STEPS runs out. */
+static int mpc_first(mpc_parser_t *p, char *set, int *steps) {
+
+  int b, j, x, f;
+
+  if (--(*steps) < 0) { return MPC_FIRST_NULLABLE | MPC_FIRST_INEXACT; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:     for (b = 0; b < 256; b++) { set[b] = 1; } return 0;
+    case MPC_TYPE_SINGLE:  set[(unsigned char)p->data.single.x] = 1; return 0;
+    case MPC_TYPE_RANGE:   for (b = 0; b < 256; b++) { set[b] |= (char)b >= p->data.range.x && (char)b <= p->data.range.y; } return 0;
+    case MPC_TYPE_ONEOF:   for (b = 0; b < 256; b++) { set[b] |= strchr(p->data.string.x, (char)b) != 0; } return 0;
+    case MPC_TYPE_NONEOF:  for (b = 0; b < 256; b++) { set[b] |= strchr(p->data.string.x, (char)b) == 0; } return 0;
+    case MPC_TYPE_SATISFY: for (b = 0; b < 256; b++) { set[b] |= p->data.satisfy.f((char)b) != 0; } return 0;
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return MPC_FIRST_NULLABLE; }
+      set[(unsigned char)p->data.string.x[0]] = 1;
+      return 0;
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_FAIL:
+      return 0;
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+      return MPC_FIRST_NULLABLE;
+
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_NOT:
+      return MPC_FIRST_NULLABLE | MPC_FIRST_INEXACT;
+
+    case MPC_TYPE_APPLY:    return mpc_first(p->data.apply.x, set, steps);
+    case MPC_TYPE_APPLY_TO: return mpc_first(p->data.apply_to.x, set, steps);
+    case MPC_TYPE_EXPECT:   return mpc_first(p->data.expect.x, set, steps);
+    case MPC_TYPE_PREDICT:  return mpc_first(p->data.predict.x, set, steps);
+    case MPC_TYPE_DFA:      return mpc_first(p->data.dfa.x, set, steps);
+
+    case MPC_TYPE_MAYBE: return mpc_first(p->data.not.x, set, steps) | MPC_FIRST_NULLABLE;
+    case MPC_TYPE_MANY:  return mpc_first(p->data.repeat.x, set, steps) | MPC_FIRST_NULLABLE;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, set, steps);
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n == 0) { return MPC_FIRST_NULLABLE; }
+      return mpc_first(p->data.repeat.x, set, steps);
+
+    case MPC_TYPE_OR:
+      for (j = 0, f = 0; j < p->data.or.n; j++) {
+        f |= mpc_first(p->data.or.xs[j], set, steps);
+      }
+      return f;
+
+    case MPC_TYPE_AND:
+      for (j = 0, f = MPC_FIRST_NULLABLE; j < p->data.and.n; j++) {
+        x = mpc_first(p->data.and.xs[j], set, steps);
+        f = (f & ~MPC_FIRST_NULLABLE) | (x & MPC_FIRST_NULLABLE) | (f & MPC_FIRST_INEXACT) | (x & MPC_FIRST_INEXACT);
+        if (!(x & MPC_FIRST_NULLABLE)) { break; }
+      }
+      return f;
+
+    default: return MPC_FIRST_NULLABLE | MPC_FIRST_INEXACT;
+  }
+}
+
+/* Returns NULL when every alternative would have to run on every byte anyway. */
+static mpc_or_table_t *mpc_or_table_new(mpc_parser_t *p) {
+
+  int j, b, f, steps, useful = 0, n = p->data.or.n;
+  char set[256];
+  mpc_or_table_t *t = malloc(sizeof(mpc_or_table_t));
+
+  t->n = n;
+  t->run = malloc(n * 257);
+
+  for (j = 0; j < n; j++) {
+    memset(set, 0, 256);
+    steps = MPC_FIRST_STEPS;
+    f = mpc_first(p->data.or.xs[j], set, &steps);
+    for (b = 0; b < 257; b++) {
+      t->run[b * n + j] = f || (b < 256 && set[b]);
+      useful |= !t->run[b * n + j];
+    }
+  }
+
+  if (!useful) {
+    free(t->run);
+    free(t);
+    return NULL;
+  }
+
+  t->errs = calloc(n * 257, sizeof(mpc_or_errs_t));
+  return t;
+}
+
+/* Returns the table row for the next byte, or NULL once P is found not worth dispatching. */
+static char *mpc_or_row(mpc_input_t *i, mpc_parser_t *p) {
+  mpc_or_table_t *t = p->data.or.table;
+  long pos = i->state.pos;
+  if (t == NULL) {
+    t = p->data.or.table = mpc_or_table_new(p);
+    if (t == NULL) {
+      p->data.or.dispatch = 0;
+      return NULL;
+    }
+  }
+  return t->run + (pos < i->length ? (unsigned char)i->string[pos] : 256) * t->n;
+}
+
+/*
+** Steps a dispatched `or` frame. Phase 1 follows a tried alternative, phase
+** 2 an alternative of the skipped group [j, k) being run to learn its
+** errors, with m the one that ran.
+*/
+
+static int mpc_parse_or(mpc_input_t *i, mpc_frame_t *f, int x, mpc_result_t *r, mpc_parser_t **q, mpc_err_t ***qe) {
+
+  mpc_parser_t *p = f->p;
+  mpc_or_table_t *t = p->data.or.table;
+  mpc_or_errs_t *errs = t->errs + (f->run - t->run);
+  mpc_err_t **e = f->e;
+  long pos;
+  int j, k, n = p->data.or.n;
+
+  if (f->phase == 0) {
+    f->start = i->state;
+    f->j = 0;
+  }
+  pos = f->start.pos;
+
+  switch (f->phase) {
+
+    case 1:
+      if (x) { return 1; }
+      *e = mpc_err_merge(i, *e, r->error);
+      f->j++;
+      break;
+
+    case 2:
+      if (x) {
+        f->run[f->m] = 1;
+        if (f->side) { *e = mpc_err_merge(i, *e, f->side); }
+        return 1;
+      }
+      f->side = mpc_err_merge(i, f->side, r->error);
+      if (++f->m < f->k) { MPC_CALL(p->data.or.xs[f->m], &f->side); }
+
+      if (f->side == NULL || f->side->state.pos == pos) {
+        errs[f->j].error = mpc_err_copy(f->side);
+        errs[f->j].has = 1;
+      } else {
+        for (j = f->j; j < f->k; j++) { f->run[j] = 1; }
+      }
+      if (f->side) { *e = mpc_err_merge(i, *e, f->side); }
+      f->j = f->k;
+      break;
+  }
+
+  for (j = f->j; j < n; j = k) {
+
+    if (f->run[j]) {
+      f->j = j;
+      f->phase = 1;
+      MPC_CALL(p->data.or.xs[j], e);
+    }
+
+    for (k = j; k < n && !f->run[k]; k++);
+    if (i->suppress) { continue; }
+
+    if (errs[j].has) {
+      *e = mpc_err_merge(i, *e, mpc_dfa_err(i, errs[j].error, pos));
+      continue;
+    }
+
+    f->j = j;
+    f->k = k;
+    f->m = j;
+    f->side = NULL;
+    f->phase = 2;
+    MPC_CALL(p->data.or.xs[j], &f->side);
+  }
+
+  MPC_FAILURE(NULL);
+}
+
+/*
+** Running Parsers
+*/
+
+/* Runs P in place if it runs no other parsers, else returns -1. */
+static int mpc_parse_leaf(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
 
   switch (p->type) {
 
@@ -1035,211 +1824,365 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
     case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
 
+    /* Compiled Parsers, whose trees are regular and so of bounded depth */
+
+    case MPC_TYPE_DFA: return mpc_parse_dfa(i, p, r, e);
+
+    case MPC_TYPE_APPLY:
+    case MPC_TYPE_APPLY_TO:
+    case MPC_TYPE_EXPECT:
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+    case MPC_TYPE_OR:
+    case MPC_TYPE_AND:
+      return -1;
+
+    default:
+
+      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+  }
+
+}
+
+/* Steps frame F, resuming it with the result X in R of the child it asked for unless it has just started. */
+static int mpc_parse_step(mpc_input_t *i, mpc_frame_t *f, int x, mpc_result_t *r, mpc_parser_t **q, mpc_err_t ***qe) {
+
+  mpc_parser_t *p = f->p;
+  mpc_err_t **e = f->e;
+  mpc_val_t *v;
+  int k;
+
+  switch (p->type) {
+
     /* Application Parsers */
 
     case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+      if (f->phase++ == 0) { MPC_CALL(p->data.apply.x, e); }
+      if (x) { MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output)); }
+      MPC_FAILURE(r->error);
 
     case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
+      if (f->phase++ == 0) { MPC_CALL(p->data.apply_to.x, e); }
+      if (x) { MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d)); }
+      MPC_FAILURE(r->error);
 
     case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+      if (f->phase++ == 0) {
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.expect.x, e);
       }
+      mpc_input_suppress_disable(i);
+      if (x) { MPC_SUCCESS(r->output); }
+      MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
 
     case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
+      if (f->phase++ == 0) {
+        mpc_input_backtrack_disable(i);
+        MPC_CALL(p->data.predict.x, e);
       }
+      mpc_input_backtrack_enable(i);
+      if (x) { MPC_SUCCESS(r->output); }
+      MPC_FAILURE(r->error);
 
     /* Optional Parsers */
 
     /* TODO: Update Not Error Message */
 
     case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
+      if (f->phase++ == 0) {
+        mpc_input_mark(i);
+        mpc_input_suppress_enable(i);
+        MPC_CALL(p->data.not.x, e);
+      }
+      if (x) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
         mpc_parse_dtor(i, p->data.not.dx, r->output);
         MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
       }
+      mpc_input_unmark(i);
+      mpc_input_suppress_disable(i);
+      MPC_SUCCESS(p->data.not.lf());
 
     case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+      if (f->phase++ == 0) { MPC_CALL(p->data.not.x, e); }
+      if (x) { MPC_SUCCESS(r->output); }
+      *e = mpc_err_merge(i, *e, r->error);
+      MPC_SUCCESS(p->data.not.lf());
 
     /* Repeat Parsers */
 
     case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (f->phase++ == 0) {
+        f->j = 0;
+        f->slots = MPC_PARSE_STACK_MIN;
+        f->results = f->stk;
+        MPC_CALL(p->data.repeat.x, e);
+      }
+      if (x) {
+        mpc_frame_add(i, f, r);
+        MPC_CALL(p->data.repeat.x, e);
+      }
+      if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+        MPC_FAILURE(mpc_err_many1(i, r->error));
+      }
+      *e = mpc_err_merge(i, *e, r->error);
+      v = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+      mpc_frame_free(i, f);
+      MPC_SUCCESS(v);
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+    case MPC_TYPE_COUNT:
+      if (f->phase++ == 0) {
+        f->j = 0;
+        f->slots = p->data.repeat.n;
+        f->results = p->data.repeat.n > MPC_PARSE_STACK_MIN
+          ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
+          : f->stk;
+        if (p->data.repeat.n == 0) { MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, 0, (mpc_val_t**)f->results)); }
+        MPC_CALL(p->data.repeat.x, e);
+      }
+      if (x) {
+        mpc_frame_add(i, f, r);
+        if (f->j < p->data.repeat.n) { MPC_CALL(p->data.repeat.x, e); }
+        v = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+        mpc_frame_free(i, f);
+        MPC_SUCCESS(v);
+      }
+      for (k = 0; k < f->j; k++) {
+        mpc_parse_dtor(i, p->data.repeat.dx, f->results[k].output);
+      }
+      mpc_frame_free(i, f);
+      MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
+
+    /* Combinatory Parsers */
+
+    case MPC_TYPE_OR:
+      if (f->phase == 0) {
+        if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+        f->run = NULL;
+        if (p->data.or.dispatch && i->type == MPC_INPUT_STRING) { f->run = mpc_or_row(i, p); }
+        if (f->run) { return mpc_parse_or(i, f, x, r, q, qe); }
+        f->phase = 1;
+        f->j = 0;
+        MPC_CALL(p->data.or.xs[0], e);
+      }
+      if (f->run) { return mpc_parse_or(i, f, x, r, q, qe); }
+      if (x) { MPC_SUCCESS(r->output); }
+      *e = mpc_err_merge(i, *e, r->error);
+      if (++f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j], e); }
+      MPC_FAILURE(NULL);
+
+    case MPC_TYPE_AND:
+      if (f->phase++ == 0) {
+        if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+        f->j = 0;
+        f->slots = p->data.and.n;
+        f->results = p->data.and.n > MPC_PARSE_STACK_MIN
+          ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.and.n)
+          : f->stk;
+        mpc_input_mark(i);
+        MPC_CALL(p->data.and.xs[0], e);
+      }
+      if (!x) {
+        mpc_input_rewind(i);
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.and.dxs[k], f->results[k].output);
         }
+        mpc_frame_free(i, f);
+        MPC_FAILURE(r->error);
       }
+      mpc_frame_add(i, f, r);
+      if (f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j], e); }
+      mpc_input_unmark(i);
+      v = mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)f->results);
+      mpc_frame_free(i, f);
+      MPC_SUCCESS(v);
+  }
+
+  MPC_FAILURE(NULL);
+}
+
+/*
+** Only retained parsers can refer back to themselves, so one that reaches
+** no other retained parser nests only as deep as its own tree, and is run
+** quicker by recursion, with its frames on the C stack. Whether it does is
+** found on first use and kept in p->flat, 1 if so and 2 if not, until the
+** parser is redefined or optimised.
+*/
+
+static int mpc_parse_flat(mpc_parser_t *p);
 
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+static int mpc_parse_flat_child(mpc_parser_t *c) {
+  return !c->retained && mpc_parse_flat(c);
+}
+
+static int mpc_parse_flat(mpc_parser_t *p) {
+
+  int j, x = 1;
+
+  if (p->flat) { return p->flat == 1; }
+
+  switch (p->type) {
+    case MPC_TYPE_APPLY:    x = mpc_parse_flat_child(p->data.apply.x); break;
+    case MPC_TYPE_APPLY_TO: x = mpc_parse_flat_child(p->data.apply_to.x); break;
+    case MPC_TYPE_EXPECT:   x = mpc_parse_flat_child(p->data.expect.x); break;
+    case MPC_TYPE_PREDICT:  x = mpc_parse_flat_child(p->data.predict.x); break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:    x = mpc_parse_flat_child(p->data.not.x); break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:    x = mpc_parse_flat_child(p->data.repeat.x); break;
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n && x; j++) { x = mpc_parse_flat_child(p->data.or.xs[j]); }
+      break;
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n && x; j++) { x = mpc_parse_flat_child(p->data.and.xs[j]); }
+      break;
+    default: break;
+  }
 
-    case MPC_TYPE_MANY1:
+  p->flat = x ? 1 : 2;
+  return x;
+}
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+static int mpc_parse_nested(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+  mpc_frame_t f;
+  mpc_parser_t *q;
+  mpc_err_t **qe;
+  int x;
 
-    case MPC_TYPE_COUNT:
+  switch (p->type) {
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+    /* Wrappers, as in mpc_parse_step */
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+    case MPC_TYPE_APPLY:
+      if (mpc_parse_nested(i, p->data.apply.x, r, e)) {
+        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
       }
+      MPC_FAILURE(r->error);
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+    case MPC_TYPE_APPLY_TO:
+      if (mpc_parse_nested(i, p->data.apply_to.x, r, e)) {
+        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
       }
+      MPC_FAILURE(r->error);
 
-    /* Combinatory Parsers */
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      x = mpc_parse_nested(i, p->data.expect.x, r, e);
+      mpc_input_suppress_disable(i);
+      if (x) { MPC_SUCCESS(r->output); }
+      MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
 
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
     case MPC_TYPE_OR:
+    case MPC_TYPE_AND:
+      break;
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
-
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        }
-      }
-
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+    default: return mpc_parse_leaf(i, p, r, e);
+  }
 
-    case MPC_TYPE_AND:
+  f.p = p;
+  f.e = e;
+  f.phase = 0;
+  x = mpc_parse_step(i, &f, -1, r, &q, &qe);
+  while (x < 0) {
+    x = mpc_parse_nested(i, q, r, qe);
+    x = mpc_parse_step(i, &f, x, r, &q, &qe);
+  }
+  return x;
+}
 
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+/*
+** Runs P, merging the errors of alternatives that fail along the way into
+** E. Frames are pushed above whatever the stack already holds, so compiled
+** parsers can run their trees by calling back in here.
+*/
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        }
-      }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+  long base = i->frames_num;
+  mpc_parser_t *q = p;
+  mpc_err_t **qe = e;
+  mpc_frame_t *f;
+  int x;
 
-    /* End */
+  while (1) {
 
-    default:
+    /* Start Q in place, or in a frame of its own */
+    if (mpc_parse_flat(q)) {
+      x = mpc_parse_nested(i, q, r, qe);
+    } else {
+      f = mpc_frame_push(i, q, qe);
+      x = mpc_parse_step(i, f, -1, r, &q, &qe);
+      if (x < 0) { continue; }
+      mpc_frame_pop(i);
+    }
 
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    /* Hand the result back down the stack until a frame asks for a child */
+    while (1) {
+      if (i->frames_num == base) { return x; }
+      f = mpc_frame_top(i);
+      x = mpc_parse_step(i, f, x, r, &q, &qe);
+      if (x < 0) { break; }
+      mpc_frame_pop(i);
+    }
   }
 
-  return 0;
-
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_CALL
+
+/*
+** Parsers defined by mpca_lang build their ASTs in an arena owned by the
+** input, which is handed over to the root of the tree on success.
+**
+** String inputs are first parsed with errors suppressed, so the failed
+** alternatives of a successful parse build no error messages. Only when
+** that fails is the input parsed again with errors live, to report them.
+** Other inputs could only be read twice by buffering them whole, so they
+** are parsed once with errors live.
+*/
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
+  int x = 0;
+  mpc_ast_t *a;
+  mpc_err_t *e = NULL;
+  if (p->arena && !i->arena) { i->arena = mpc_arena_new(); }
+  if (i->type == MPC_INPUT_STRING) {
+    mpc_input_mark(i);
+    mpc_input_suppress_enable(i);
+    x = mpc_parse_run(i, p, r, &e);
+    mpc_input_suppress_disable(i);
+    if (x) { mpc_input_unmark(i); } else { mpc_input_rewind(i); }
+  }
+  if (!x) {
+    e = mpc_err_fail(i, "Unknown Error");
+    e->state = mpc_state_invalid();
+    x = mpc_parse_run(i, p, r, &e);
+  }
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
+    a = p->arena ? r->output : NULL;
+    if (a && a->arena == i->arena) {
+      a->arena->root = a;
+      i->arena = NULL;
+    }
   } else {
     r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
@@ -1307,6 +2250,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_or_table_delete(p->data.or.table);
 
 }
 
@@ -1358,6 +2302,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
+    case MPC_TYPE_DFA:
+      mpc_dfa_delete(p->data.dfa.d);
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      break;
+
     default: break;
   }
 
@@ -1403,6 +2352,8 @@ mpc_parser_t *mpc_new(const char *name) {
   return p;
 }
 
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *x);
+
 mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   int i = 0;
   mpc_parser_t *p;
@@ -1455,6 +2406,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       break;
 
     case MPC_TYPE_OR:
+      p->data.or.table = NULL;
       p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
@@ -1471,6 +2423,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       }
     break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_new(p->data.dfa.x);
+    break;
+
     default: break;
   }
 
@@ -1481,6 +2438,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
+  p->flat = 0;
   return p;
 }
 
@@ -1489,6 +2447,7 @@ mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   if (p->retained) {
     p->type = a->type;
     p->data = a->data;
+    p->flat = 0;
   } else {
     mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
     p->type = a2->type;
@@ -2160,6 +3119,406 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Regex DFA Construction
+**
+** A state is the stack of parsers still to be matched, innermost on top.
+** For each byte class the top of the stack is expanded until a character
+** set consumes the byte, the stack empties (the regex has matched) or the
+** match fails. Choices are made the way mpc_parse_run makes them: `or`
+** takes its first alternative that does not fail on the byte, `maybe` and
+** `many` run their parser only when it would not fail on it.
+**
+** That is faithful only while a parser which starts consuming input either
+** succeeds or fails the whole match, as nothing can backtrack out of it.
+** mpc_dfa_late checks this for the bodies of `maybe` and `many` and for all
+** but the last alternative of `or`. Regexes outside that subset, or with
+** too many states, keep their tree.
+*/
+
+enum {
+  MPC_DFA_CONSUME     = 0,
+  MPC_DFA_EMPTY       = 1,
+  MPC_DFA_FAIL        = 2,
+  MPC_DFA_UNSUPPORTED = 3,
+
+  MPC_DFA_MAX_LEAVES  = 64,
+  MPC_DFA_MAX_DEPTH   = 64,
+  MPC_DFA_MAX_STEPS   = 4096
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  int n;
+} mpc_dfa_item_t;
+
+typedef struct {
+  int num;
+  mpc_dfa_item_t items[MPC_DFA_MAX_DEPTH];
+} mpc_dfa_stack_t;
+
+typedef struct {
+  int leaves_num;
+  mpc_parser_t *leaves[MPC_DFA_MAX_LEAVES];
+  char sets[MPC_DFA_MAX_LEAVES][256];
+  int classes;
+  unsigned char cls[256];
+  unsigned char rep[256];
+  int states;
+  mpc_dfa_stack_t *stacks[MPC_DFA_MAX_STATES];
+} mpc_dfa_build_t;
+
+/*
+** Fills SET with the bytes P matches when P always matches exactly one
+** byte and reports no errors of its own besides on failure. An `or` only
+** qualifies under `expect`, which hides the errors of its alternatives.
+*/
+
+static int mpc_dfa_charset(mpc_parser_t *p, char *set, int expect) {
+
+  int b, j;
+  char sub[256];
+
+  if (p->retained) { return 0; }
+
+  switch (p->type) {
+    case MPC_TYPE_ANY:     for (b = 0; b < 256; b++) { set[b] = 1; } return 1;
+    case MPC_TYPE_SINGLE:  for (b = 0; b < 256; b++) { set[b] = (char)b == p->data.single.x; } return 1;
+    case MPC_TYPE_RANGE:   for (b = 0; b < 256; b++) { set[b] = (char)b >= p->data.range.x && (char)b <= p->data.range.y; } return 1;
+    case MPC_TYPE_ONEOF:   for (b = 0; b < 256; b++) { set[b] = strchr(p->data.string.x, (char)b) != 0; } return 1;
+    case MPC_TYPE_NONEOF:  for (b = 0; b < 256; b++) { set[b] = strchr(p->data.string.x, (char)b) == 0; } return 1;
+    case MPC_TYPE_SATISFY: for (b = 0; b < 256; b++) { set[b] = p->data.satisfy.f((char)b) != 0; } return 1;
+    case MPC_TYPE_EXPECT:  return mpc_dfa_charset(p->data.expect.x, set, 1);
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0 || !expect) { return 0; }
+      memset(set, 0, 256);
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_charset(p->data.or.xs[j], sub, 1)) { return 0; }
+        for (b = 0; b < 256; b++) { set[b] |= sub[b]; }
+      }
+      return 1;
+    default: return 0;
+  }
+}
+
+/* Collects the character sets of P, checking every other node folds to the matched text. */
+static int mpc_dfa_collect(mpc_dfa_build_t *b, mpc_parser_t *p) {
+
+  int j;
+
+  if (p->retained) { return 0; }
+
+  if (mpc_dfa_charset(p, b->sets[b->leaves_num], 0)) {
+    if (b->leaves_num == MPC_DFA_MAX_LEAVES - 1) { return 0; }
+    b->leaves[b->leaves_num++] = p;
+    return 1;
+  }
+
+  switch (p->type) {
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str;
+    case MPC_TYPE_MAYBE:
+      return p->data.not.lf == mpcf_ctor_str && mpc_dfa_collect(b, p->data.not.x);
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.f == mpcf_strfold && mpc_dfa_collect(b, p->data.repeat.x);
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_collect(b, p->data.or.xs[j])) { return 0; }
+      }
+      return 1;
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0 || p->data.and.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_collect(b, p->data.and.xs[j])) { return 0; }
+      }
+      return 1;
+    default: return 0;
+  }
+}
+
+/* Two bytes share a class when every character set agrees on them. */
+static void mpc_dfa_classes(mpc_dfa_build_t *b) {
+  int x, k, j;
+  b->classes = 0;
+  for (x = 0; x < 256; x++) {
+    for (k = 0; k < b->classes; k++) {
+      for (j = 0; j < b->leaves_num; j++) {
+        if (b->sets[j][x] != b->sets[j][b->rep[k]]) { break; }
+      }
+      if (j == b->leaves_num) { break; }
+    }
+    if (k == b->classes) { b->rep[b->classes++] = (unsigned char)x; }
+    b->cls[x] = (unsigned char)k;
+  }
+  b->classes++;
+}
+
+static int mpc_dfa_leaf(mpc_dfa_build_t *b, mpc_parser_t *p) {
+  int j;
+  for (j = 0; j < b->leaves_num; j++) {
+    if (b->leaves[j] == p) { return j; }
+  }
+  return -1;
+}
+
+static int mpc_dfa_push(mpc_dfa_stack_t *stk, mpc_parser_t *p) {
+  if (stk->num == MPC_DFA_MAX_DEPTH) { return 0; }
+  stk->items[stk->num].p = p;
+  stk->items[stk->num].n = 0;
+  stk->num++;
+  return 1;
+}
+
+static int mpc_dfa_probe(mpc_dfa_build_t *b, mpc_parser_t *p, int k);
+
+/*
+** Expands STK against byte class K. SIDE is set when a choice is decided
+** by a parser failing, as the tree records an error there.
+*/
+
+static int mpc_dfa_step(mpc_dfa_build_t *b, mpc_dfa_stack_t *stk, int k, int *side) {
+
+  int j, x, steps;
+  mpc_dfa_item_t *top;
+  mpc_parser_t *p;
+
+  for (steps = 0; steps < MPC_DFA_MAX_STEPS; steps++) {
+
+    if (stk->num == 0) { return MPC_DFA_EMPTY; }
+
+    top = &stk->items[stk->num-1];
+    p = top->p;
+
+    j = mpc_dfa_leaf(b, p);
+    if (j >= 0) {
+      if (k == b->classes - 1 || !b->sets[j][b->rep[k]]) { return MPC_DFA_FAIL; }
+      stk->num--;
+      return MPC_DFA_CONSUME;
+    }
+
+    switch (p->type) {
+
+      case MPC_TYPE_LIFT:
+        stk->num--;
+        break;
+
+      case MPC_TYPE_AND:
+        stk->num--;
+        for (j = p->data.and.n-1; j >= 0; j--) {
+          if (!mpc_dfa_push(stk, p->data.and.xs[j])) { return MPC_DFA_UNSUPPORTED; }
+        }
+        break;
+
+      case MPC_TYPE_OR:
+        for (j = 0; j < p->data.or.n; j++) {
+          x = mpc_dfa_probe(b, p->data.or.xs[j], k);
+          if (x == MPC_DFA_UNSUPPORTED) { return x; }
+          if (x != MPC_DFA_FAIL) { break; }
+          *side = 1;
+        }
+        if (j == p->data.or.n) { return MPC_DFA_FAIL; }
+        top->p = p->data.or.xs[j];
+        top->n = 0;
+        break;
+
+      case MPC_TYPE_MAYBE:
+        x = mpc_dfa_probe(b, p->data.not.x, k);
+        if (x == MPC_DFA_UNSUPPORTED) { return x; }
+        if (x == MPC_DFA_FAIL) {
+          *side = 1;
+          stk->num--;
+        } else {
+          top->p = p->data.not.x;
+          top->n = 0;
+        }
+        break;
+
+      /* A `many1` item counts one once its first match is underway, and then loops like `many` */
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+        if (p->type == MPC_TYPE_MANY1 && top->n == 0) {
+          top->n = 1;
+          if (!mpc_dfa_push(stk, p->data.repeat.x)) { return MPC_DFA_UNSUPPORTED; }
+          break;
+        }
+        x = mpc_dfa_probe(b, p->data.repeat.x, k);
+        if (x == MPC_DFA_UNSUPPORTED || x == MPC_DFA_EMPTY) { return MPC_DFA_UNSUPPORTED; }
+        if (x == MPC_DFA_FAIL) {
+          *side = 1;
+          stk->num--;
+        } else if (!mpc_dfa_push(stk, p->data.repeat.x)) {
+          return MPC_DFA_UNSUPPORTED;
+        }
+        break;
+
+      case MPC_TYPE_COUNT:
+        if (top->n == p->data.repeat.n) {
+          stk->num--;
+        } else {
+          top->n++;
+          if (!mpc_dfa_push(stk, p->data.repeat.x)) { return MPC_DFA_UNSUPPORTED; }
+        }
+        break;
+
+      default:
+        return MPC_DFA_UNSUPPORTED;
+    }
+  }
+
+  return MPC_DFA_UNSUPPORTED;
+}
+
+/* What P alone does on byte class K. */
+static int mpc_dfa_probe(mpc_dfa_build_t *b, mpc_parser_t *p, int k) {
+  int side = 0;
+  mpc_dfa_stack_t stk;
+  stk.num = 0;
+  mpc_dfa_push(&stk, p);
+  return mpc_dfa_step(b, &stk, k, &side);
+}
+
+/* The set of probe results P gives over all byte classes. */
+static int mpc_dfa_outcomes(mpc_dfa_build_t *b, mpc_parser_t *p) {
+  int k, o = 0;
+  for (k = 0; k < b->classes; k++) { o |= 1 << mpc_dfa_probe(b, p, k); }
+  return o;
+}
+
+/* Whether P can fail after consuming input: 0, 1, or -1 when the DFA could not follow P. */
+static int mpc_dfa_late(mpc_dfa_build_t *b, mpc_parser_t *p) {
+
+  int j, x, o, late = 0, consumed = 0;
+
+  if (mpc_dfa_leaf(b, p) >= 0) { return 0; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_LIFT: return 0;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        x = mpc_dfa_late(b, p->data.and.xs[j]);
+        o = mpc_dfa_outcomes(b, p->data.and.xs[j]);
+        if (x < 0 || (o & (1 << MPC_DFA_UNSUPPORTED))) { return -1; }
+        if (x || (consumed && (o & (1 << MPC_DFA_FAIL)))) { late = 1; }
+        if (o & (1 << MPC_DFA_CONSUME)) { consumed = 1; }
+      }
+      return late;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        x = mpc_dfa_late(b, p->data.or.xs[j]);
+        if (x < 0 || (x && j < p->data.or.n-1)) { return -1; }
+        late |= x;
+      }
+      return late;
+
+    case MPC_TYPE_MAYBE:
+      return mpc_dfa_late(b, p->data.not.x) ? -1 : 0;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      o = mpc_dfa_outcomes(b, p->data.repeat.x);
+      if (o & ((1 << MPC_DFA_EMPTY) | (1 << MPC_DFA_UNSUPPORTED))) { return -1; }
+      return mpc_dfa_late(b, p->data.repeat.x) ? -1 : 0;
+
+    case MPC_TYPE_COUNT:
+      x = mpc_dfa_late(b, p->data.repeat.x);
+      o = mpc_dfa_outcomes(b, p->data.repeat.x);
+      if (x || (o & (1 << MPC_DFA_UNSUPPORTED))) { return x ? x : -1; }
+      return p->data.repeat.n > 1 && (o & (1 << MPC_DFA_CONSUME)) && (o & (1 << MPC_DFA_FAIL));
+
+    default: return -1;
+  }
+}
+
+static int mpc_dfa_state(mpc_dfa_build_t *b, mpc_dfa_stack_t *stk) {
+  int s, j;
+  for (s = 0; s < b->states; s++) {
+    if (b->stacks[s]->num != stk->num) { continue; }
+    for (j = 0; j < stk->num; j++) {
+      if (b->stacks[s]->items[j].p != stk->items[j].p
+      ||  b->stacks[s]->items[j].n != stk->items[j].n) { break; }
+    }
+    if (j == stk->num) { return s; }
+  }
+  if (b->states == MPC_DFA_MAX_STATES) { return -1; }
+  b->stacks[b->states] = malloc(sizeof(mpc_dfa_stack_t));
+  memcpy(b->stacks[b->states], stk, sizeof(mpc_dfa_stack_t));
+  return b->states++;
+}
+
+static mpc_dfa_t *mpc_dfa_tables(mpc_dfa_build_t *b, mpc_parser_t *x) {
+
+  int s, k, t, res, side, next;
+  mpc_dfa_stack_t stk;
+  mpc_dfa_t *d = calloc(1, sizeof(mpc_dfa_t));
+
+  d->classes = b->classes;
+  memcpy(d->cls, b->cls, sizeof(d->cls));
+  d->move = malloc(sizeof(int) * MPC_DFA_MAX_STATES * b->classes);
+  d->side = calloc(MPC_DFA_MAX_STATES * b->classes, 1);
+
+  stk.num = 0;
+  mpc_dfa_push(&stk, x);
+  mpc_dfa_state(b, &stk);
+
+  for (s = 0; s < b->states; s++) {
+    for (k = 0; k < b->classes; k++) {
+      memcpy(&stk, b->stacks[s], sizeof(mpc_dfa_stack_t));
+      side = 0;
+      res = mpc_dfa_step(b, &stk, k, &side);
+      t = s * b->classes + k;
+      d->side[t] = (char)side;
+      if (res == MPC_DFA_EMPTY)   { d->move[t] = MPC_DFA_ACCEPT; continue; }
+      if (res == MPC_DFA_FAIL)    { d->move[t] = MPC_DFA_REJECT; continue; }
+      next = res == MPC_DFA_CONSUME ? mpc_dfa_state(b, &stk) : -1;
+      if (next < 0) {
+        free(d->move); free(d->side); free(d);
+        return NULL;
+      }
+      d->move[t] = ((next * b->classes) << 1) | side;
+    }
+  }
+
+  d->states = b->states;
+  d->move = realloc(d->move, sizeof(int) * d->states * d->classes);
+  d->side = realloc(d->side, d->states * d->classes);
+  d->errs = calloc(d->states * d->classes, sizeof(mpc_dfa_errs_t));
+  d->exact = 1;
+  return d;
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *x) {
+
+  int s;
+  mpc_dfa_t *d = NULL;
+  mpc_dfa_build_t *b = calloc(1, sizeof(mpc_dfa_build_t));
+
+  if (mpc_dfa_collect(b, x)) {
+    mpc_dfa_classes(b);
+    if (mpc_dfa_late(b, x) >= 0) { d = mpc_dfa_tables(b, x); }
+  }
+
+  for (s = 0; s < b->states; s++) { free(b->stacks[s]); }
+  free(b);
+  return d;
+}
+
+/* Wraps X in a DFA parser when it compiles to one, otherwise returns X itself. */
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *x) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(x);
+  if (d == NULL) { return x; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = x;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
 
   char *err_msg;
@@ -2223,7 +3582,7 @@ mpc_parser_t *mpc_re(const char *re) {
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return mpc_re_dfa(r.output);
 
 }
 
@@ -2576,6 +3935,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
   if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
 
+  if (p->type == MPC_TYPE_DFA) { mpc_print_unretained(p->data.dfa.x, 0); }
+
   if (p->type == MPC_TYPE_OR) {
     printf("(");
     for(i = 0; i < p->data.or.n-1; i++) {
@@ -2673,11 +4034,36 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+/*
+** An arena node is only freed with its arena, when the root is deleted.
+** Children from outside the arena are walked only if any were ever added.
+*/
+
+static void mpc_ast_delete_arena(mpc_ast_t *a) {
+
+  int i;
+  mpc_arena_t *m = a->arena;
+
+  if (m->foreign) {
+    for (i = 0; i < a->children_num; i++) {
+      if (a->children[i] && a->children[i]->arena == m) {
+        mpc_ast_delete_arena(a->children[i]);
+      } else {
+        mpc_ast_delete(a->children[i]);
+      }
+    }
+  }
+
+  if (a == m->root) { mpc_arena_delete(m); }
+
+}
+
 void mpc_ast_delete(mpc_ast_t *a) {
 
   int i;
 
   if (a == NULL) { return; }
+  if (a->arena) { mpc_ast_delete_arena(a); return; }
 
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
@@ -2691,6 +4077,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2711,6 +4098,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->children_num = 0;
   a->children = NULL;
+  a->arena = NULL;
   return a;
 
 }
@@ -2741,7 +4129,13 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  if (a->arena) {
+    r = mpc_arena_ast(a->arena, ">", "");
+    if (a->arena->root == a) { a->arena->root = r; }
+  } else {
+    r = mpc_ast_new(">", "");
+  }
+
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -2761,7 +4155,22 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   return 1;
 }
 
+/* Arena children arrays are sized in powers of two and copied when full. */
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+
+  mpc_ast_t **children;
+
+  if (r->arena) {
+    if ((r->children_num & (r->children_num - 1)) == 0) {
+      children = mpc_arena_alloc(r->arena, sizeof(mpc_ast_t*) * (r->children_num ? r->children_num * 2 : 1));
+      if (r->children_num) { memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+      r->children = children;
+    }
+    r->children[r->children_num++] = a;
+    if (a && a->arena != r->arena) { r->arena->foreign = 1; }
+    return r;
+  }
+
   r->children_num++;
   r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num-1] = a;
@@ -2770,6 +4179,10 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  if (a->arena) {
+    a->tag = mpc_arena_tag(a->arena, t, strlen(t), "|", a->tag);
+    return a;
+  }
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
@@ -2779,6 +4192,10 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  if (a->arena) {
+    a->tag = mpc_arena_tag(a->arena, t, strlen(t)-1, a->tag, "");
+    return a;
+  }
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, (strlen(t)-1));
@@ -2786,6 +4203,10 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  if (a->arena) {
+    a->tag = mpc_arena_tag(a->arena, t, strlen(t), "", "");
+    return a;
+  }
   a->tag = realloc(a->tag, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
@@ -3010,7 +4431,8 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
 
-  r = mpc_ast_new(">", "");
+  for (i = 0; i < n && !(as[i] && as[i]->arena); i++) {}
+  r = i < n ? mpc_arena_ast(as[i]->arena, ">", "") : mpc_ast_new(">", "");
 
   for (i = 0; i < n; i++) {
 
@@ -3443,6 +4865,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
+    left->arena = 1;
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
@@ -3643,6 +5066,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
 
+  if (p->type == MPC_TYPE_DFA) { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+
   if (p->type == MPC_TYPE_OR) {
     total = 0;
     for(i = 0; i < p->data.or.n; i++) {
@@ -3676,6 +5101,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
 
   if (p->retained && !force) { return; }
 
+  p->flat = 0;
+
   /* Optimise Subexpressions */
 
   if (p->type == MPC_TYPE_EXPECT)   { mpc_optimise_unretained(p->data.expect.x, 0); }
@@ -3713,6 +5140,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_or_table_delete(p->data.or.table); p->data.or.table = NULL;
+      mpc_or_table_delete(t->data.or.table);
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -3727,6 +5156,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_or_table_delete(p->data.or.table); p->data.or.table = NULL;
+      mpc_or_table_delete(t->data.or.table);
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -3830,6 +5261,11 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
+    /* Dispatch `or` on the next character */
+    if (p->type == MPC_TYPE_OR && p->data.or.n > 1) {
+      p->data.or.dispatch = 1;
+    }
+
     return;
 
   }
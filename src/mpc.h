@@ -267,6 +267,7 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  struct mpc_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -353,6 +354,20 @@ void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
 
+/*
+** Pool counters, summed over every parse so far. A hit is a value served
+** from an input's pool and a fallback one too big for it, sent to malloc.
+** Parses running at the same time on several threads may lose counts.
+*/
+
+typedef struct {
+  unsigned long hits;
+  unsigned long fallbacks;
+  unsigned long chunks;
+} mpc_mem_stats_t;
+
+void mpc_mem_stats(mpc_mem_stats_t *s);
+
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*),
   mpc_dtor_t destructor,
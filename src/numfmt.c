@@ -0,0 +1,256 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "numfmt.h"
+#include "numfmt_table.h"
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+#define POW5_INV_BITCOUNT 125
+#define POW5_BITCOUNT 125
+
+static const char DIGIT_PAIRS[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Writes the decimal digits of X ending just before END, two at a time. Returns where they start. */
+static char* write_digits(char* end, uint64_t x) {
+    while (x >= 100) {
+        uint64_t q = x / 100;
+        end -= 2;
+        memcpy(end, DIGIT_PAIRS + 2 * (x - 100 * q), 2);
+        x = q;
+    }
+    if (x >= 10) {
+        end -= 2;
+        memcpy(end, DIGIT_PAIRS + 2 * x, 2);
+    } else {
+        *--end = '0' + x;
+    }
+    return end;
+}
+
+int numfmt_integer(char* buf, long x) {
+    char digits[NUMFMT_INTEGER_MAX];
+    char* end = digits + sizeof(digits);
+    uint64_t u = x < 0 ? -(uint64_t) x : (uint64_t) x;
+    char* start = write_digits(end, u);
+    if (x < 0) *--start = '-';
+    memcpy(buf, start, end - start);
+    return end - start;
+}
+
+/* ceil(log2(5^e)), or 1 for e == 0. */
+static int32_t pow5bits(int32_t e) {
+    return (int32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+static uint32_t log10_pow2(int32_t e) {
+    return ((uint32_t) e * 78913) >> 18;
+}
+
+static uint32_t log10_pow5(int32_t e) {
+    return ((uint32_t) e * 732923) >> 20;
+}
+
+static bool multiple_of_pow5(uint64_t x, uint32_t p) {
+    uint32_t count = 0;
+    while (x % 5 == 0) {
+        x /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static bool multiple_of_pow2(uint64_t x, uint32_t p) {
+    return (x & ((1ull << p) - 1)) == 0;
+}
+
+static uint64_t mul_shift(uint64_t m, const uint64_t* mul, int32_t j) {
+    __uint128_t b0 = (__uint128_t) m * mul[0];
+    __uint128_t b2 = (__uint128_t) m * mul[1];
+    return (uint64_t) (((b0 >> 64) + b2) >> (j - 64));
+}
+
+/*
+ * Ryu's d2d: the shortest decimal OUTPUT * 10^E10 inside the interval of
+ * reals that round to the double with the given fields. See Ulf Adams,
+ * "Ryu: fast float-to-string conversion", PLDI 2018.
+ */
+static void shortest_decimal(uint64_t mantissa, uint32_t exponent, uint64_t* output, int32_t* e10) {
+    int32_t e2;
+    uint64_t m2;
+    if (exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = mantissa;
+    } else {
+        e2 = (int32_t) exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ull << DOUBLE_MANTISSA_BITS) | mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    /* The double and the midpoints to its neighbours, all times 4. */
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = mantissa != 0 || exponent <= 1;
+
+    uint64_t vr, vp, vm;
+    bool vm_trailing_zeros = false;
+    bool vr_trailing_zeros = false;
+    if (e2 >= 0) {
+        uint32_t q = log10_pow2(e2) - (e2 > 3);
+        *e10 = (int32_t) q;
+        int32_t k = POW5_INV_BITCOUNT + pow5bits((int32_t) q) - 1;
+        int32_t i = -e2 + (int32_t) q + k;
+        vr = mul_shift(4 * m2, NUMFMT_POW5_INV[q], i);
+        vp = mul_shift(4 * m2 + 2, NUMFMT_POW5_INV[q], i);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, NUMFMT_POW5_INV[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        *e10 = (int32_t) q + e2;
+        int32_t i = -e2 - (int32_t) q;
+        int32_t k = pow5bits(i) - POW5_BITCOUNT;
+        int32_t j = (int32_t) q - k;
+        vr = mul_shift(4 * m2, NUMFMT_POW5[i], j);
+        vp = mul_shift(4 * m2 + 2, NUMFMT_POW5[i], j);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, NUMFMT_POW5[i], j);
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds) vm_trailing_zeros = mm_shift == 1;
+            else vp--;
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Drop digits while the interval still holds a shorter number, rounding the last one dropped. */
+    int32_t removed = 0;
+    uint8_t last_removed = 0;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4;
+        *output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        *output = vr + (vr == vm || round_up);
+    }
+    *e10 += removed;
+}
+
+/* Doubles that are whole numbers below 2^53 need no search, only their trailing zeros stripped. */
+static bool small_integer(uint64_t mantissa, uint32_t exponent, uint64_t* output, int32_t* e10) {
+    uint64_t m2 = (1ull << DOUBLE_MANTISSA_BITS) | mantissa;
+    int32_t e2 = (int32_t) exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS;
+    if (e2 > 0 || e2 < -DOUBLE_MANTISSA_BITS) return false;
+    if (m2 & ((1ull << -e2) - 1)) return false;
+
+    *output = m2 >> -e2;
+    *e10 = 0;
+    while (*output % 10 == 0) {
+        *output /= 10;
+        (*e10)++;
+    }
+    return true;
+}
+
+int numfmt_real(char* buf, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bool negative = bits >> 63;
+    uint64_t mantissa = bits & ((1ull << DOUBLE_MANTISSA_BITS) - 1);
+    uint32_t exponent = (bits >> DOUBLE_MANTISSA_BITS) & ((1u << DOUBLE_EXPONENT_BITS) - 1);
+
+    char* p = buf;
+    if (exponent == (1u << DOUBLE_EXPONENT_BITS) - 1) {
+        if (mantissa) {
+            memcpy(p, "nan", 3);
+            return 3;
+        }
+        if (negative) *p++ = '-';
+        memcpy(p, "inf", 3);
+        return p + 3 - buf;
+    }
+
+    if (negative) *p++ = '-';
+    if (exponent == 0 && mantissa == 0) {
+        memcpy(p, "0.0", 3);
+        return p + 3 - buf;
+    }
+
+    uint64_t output;
+    int32_t e10;
+    if (!small_integer(mantissa, exponent, &output, &e10)) shortest_decimal(mantissa, exponent, &output, &e10);
+
+    char digits[NUMFMT_INTEGER_MAX];
+    char* end = digits + sizeof(digits);
+    char* start = write_digits(end, output);
+    int32_t length = end - start;
+
+    /* OUTPUT * 10^E10 in plain notation: the '.' goes LENGTH + E10 digits in. */
+    int32_t point = length + e10;
+    if (e10 >= 0) {
+        memcpy(p, start, length);
+        p += length;
+        memset(p, '0', e10);
+        p += e10;
+        memcpy(p, ".0", 2);
+        p += 2;
+    } else if (point > 0) {
+        memcpy(p, start, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, start + point, length - point);
+        p += length - point;
+    } else {
+        memcpy(p, "0.", 2);
+        p += 2;
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, start, length);
+        p += length;
+    }
+    return p - buf;
+}
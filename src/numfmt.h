@@ -0,0 +1,17 @@
+#ifndef MLISP_NUMFMT_H
+#define MLISP_NUMFMT_H
+
+/*
+ * Number formatting for the printers, independent of the C locale. Reals
+ * are written with the fewest digits that read back to the same double
+ * (Ryu), in the plain notation the reader accepts: always a '.', never an
+ * exponent. Each function writes to BUF without a NUL and returns the length.
+ */
+
+#define NUMFMT_INTEGER_MAX 20
+#define NUMFMT_REAL_MAX 330
+
+int numfmt_integer(char* buf, long x);
+int numfmt_real(char* buf, double x);
+
+#endif
@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "numfmt.h"
+#include "output.h"
+
+typedef enum { OUTPUT_UNKNOWN, OUTPUT_LINE, OUTPUT_BLOCK } output_mode_t;
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_length = 0;
+static output_mode_t output_mode = OUTPUT_UNKNOWN;
+
+/* Decided on the first write, which also arranges for the last block to go out at exit. */
+static void output_start(void) {
+    output_mode = isatty(STDOUT_FILENO) ? OUTPUT_LINE : OUTPUT_BLOCK;
+    atexit(output_flush);
+}
+
+void output_flush(void) {
+    if (output_length) {
+        fwrite(output_buffer, 1, output_length, stdout);
+        output_length = 0;
+    }
+    fflush(stdout);
+}
+
+void output_char(char c) {
+    if (output_mode == OUTPUT_UNKNOWN) output_start();
+    if (output_length == OUTPUT_BUFFER_SIZE) output_flush();
+    output_buffer[output_length++] = c;
+    if (c == '\n' && output_mode == OUTPUT_LINE) output_flush();
+}
+
+void output_write(const char* s, size_t n) {
+    if (output_mode == OUTPUT_UNKNOWN) output_start();
+    if (n > OUTPUT_BUFFER_SIZE - output_length) {
+        output_flush();
+        if (n >= OUTPUT_BUFFER_SIZE) {
+            fwrite(s, 1, n, stdout);
+            fflush(stdout);
+            return;
+        }
+    }
+    memcpy(output_buffer + output_length, s, n);
+    output_length += n;
+    if (output_mode == OUTPUT_LINE && memchr(s, '\n', n)) output_flush();
+}
+
+void output_str(const char* s) {
+    output_write(s, strlen(s));
+}
+
+/* Formats straight into the buffer when the result fits, as it almost always does. */
+void output_format(const char* fmt, ...) {
+    if (output_mode == OUTPUT_UNKNOWN) output_start();
+    va_list va;
+    va_start(va, fmt);
+    size_t room = OUTPUT_BUFFER_SIZE - output_length;
+    int n = vsnprintf(output_buffer + output_length, room, fmt, va);
+    va_end(va);
+    if (n < 0) return;
+
+    if ((size_t) n < room) {
+        output_length += n;
+        if (output_mode == OUTPUT_LINE && memchr(output_buffer + output_length - n, '\n', n)) output_flush();
+        return;
+    }
+
+    char* s = malloc(n + 1);
+    va_start(va, fmt);
+    vsnprintf(s, n + 1, fmt, va);
+    va_end(va);
+    output_write(s, n);
+    free(s);
+}
+
+/* Numbers are formatted in place, after making room for the longest one. */
+void output_integer(long x) {
+    if (output_mode == OUTPUT_UNKNOWN) output_start();
+    if (OUTPUT_BUFFER_SIZE - output_length < NUMFMT_INTEGER_MAX) output_flush();
+    output_length += numfmt_integer(output_buffer + output_length, x);
+}
+
+void output_real(double x) {
+    if (output_mode == OUTPUT_UNKNOWN) output_start();
+    if (OUTPUT_BUFFER_SIZE - output_length < NUMFMT_REAL_MAX) output_flush();
+    output_length += numfmt_real(output_buffer + output_length, x);
+}
@@ -0,0 +1,23 @@
+#ifndef MLISP_OUTPUT_H
+#define MLISP_OUTPUT_H
+
+#include <stddef.h>
+
+/*
+ * Buffered standard output for the printers. Writes collect in one buffer
+ * that is handed to stdout in a single block when it fills, at each newline
+ * when stdout is a terminal, and on output_flush. Anything else that writes
+ * to stdout should call output_flush first so the two stay in order.
+ */
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+void output_char(char c);
+void output_write(const char* s, size_t n);
+void output_str(const char* s);
+void output_format(const char* fmt, ...);
+void output_integer(long x);
+void output_real(double x);
+void output_flush(void);
+
+#endif
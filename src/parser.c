@@ -3,6 +3,11 @@
 
 #include "parser.h"
 
+/* resources/lisp.grammar, embedded by the Makefile so the binary does not depend on the working directory. */
+static const char LISP_GRAMMAR[] =
+#include "lisp.grammar.inc"
+;
+
 parser_t* parser_build() {
     parser_t* parser = malloc(sizeof(parser_t));
     parser->integer = mpc_new("integer");
@@ -10,19 +15,21 @@ parser_t* parser_build() {
     parser->boolean = mpc_new("boolean");
     parser->symbol = mpc_new("symbol");
     parser->string = mpc_new("string");
+    parser->comment = mpc_new("comment");
     parser->sexpr = mpc_new("sexpr");
     parser->qexpr = mpc_new("qexpr");
     parser->expr = mpc_new("expr");
     parser->lispy = mpc_new("lispy");
 
-    mpc_err_t* err = mpca_lang_contents(
+    mpc_err_t* err = mpca_lang(
         MPCA_LANG_DEFAULT,
-        "resources/lisp.grammar",
+        LISP_GRAMMAR,
         parser->integer,
         parser->real,
         parser->boolean,
         parser->symbol,
         parser->string,
+        parser->comment,
         parser->sexpr,
         parser->qexpr,
         parser->expr,
@@ -39,12 +46,13 @@ parser_t* parser_build() {
 
 void parser_cleanup(parser_t* parser) {
     mpc_cleanup(
-        9,
+        10,
         parser->integer,
         parser->real,
         parser->boolean,
         parser->symbol,
         parser->string,
+        parser->comment,
         parser->sexpr,
         parser->qexpr,
         parser->expr,
@@ -52,6 +60,7 @@ void parser_cleanup(parser_t* parser) {
     free(parser);
 }
 
-int parser_parse(parser_t* parser, char* input, mpc_result_t* result_p) {
-  return mpc_parse("<stdin>", input, parser->lispy, result_p);
+/* INPUT is borrowed, not copied, and need not be NUL terminated. */
+int parser_parse(parser_t* parser, const char* input, size_t length, mpc_result_t* result_p) {
+  return mpc_nparse("<stdin>", input, length, parser->lispy, result_p);
 }
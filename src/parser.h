@@ -9,6 +9,7 @@ typedef struct {
     mpc_parser_t* boolean;
     mpc_parser_t* symbol;
     mpc_parser_t* string;
+    mpc_parser_t* comment;
     mpc_parser_t* sexpr;
     mpc_parser_t* qexpr;
     mpc_parser_t* expr;
@@ -17,5 +18,5 @@ typedef struct {
 
 parser_t* parser_build();
 void parser_cleanup(parser_t* parser);
-int parser_parse(parser_t* parser, char* input, mpc_result_t* result_p);
+int parser_parse(parser_t* parser, const char* input, size_t length, mpc_result_t* result_p);
 #endif
@@ -0,0 +1,496 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "eval.h"
+#include "reader.h"
+
+/* Byte classes: blank (mpc_blank's set), decimal digit, symbol character. */
+enum { RB = 1, RD = 2, RS = 4 };
+
+static const unsigned char READER_CLASS[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, RB, RB, RB, RB, RB, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    RB, RS, 0, 0, 0, RS, RS, 0, 0, 0, RS, RS, 0, RS, 0, RS,
+    RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, RD|RS, 0, 0, RS, RS, RS, RS,
+    0, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS,
+    RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, 0, RS, 0, RS, RS,
+    0, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS,
+    RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, RS, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* An open ( or { whose elements start at values[start]. */
+typedef struct {
+    lval_t type;
+    char close;
+    int start;
+    size_t pos;
+} reader_frame;
+
+typedef struct {
+    const unsigned char* s;
+    size_t length;
+    size_t pos;
+
+    lval** values;
+    int count;
+    int capacity;
+
+    reader_frame* frames;
+    int depth;
+    int frames_capacity;
+
+    char* token;
+    size_t token_capacity;
+} reader_t;
+
+static bool reader_is(reader_t* r, size_t i, int class) {
+    return i < r->length && (READER_CLASS[r->s[i]] & class);
+}
+
+static size_t reader_digits(reader_t* r, size_t i) {
+    while (reader_is(r, i, RD)) i++;
+    return i;
+}
+
+/* The match_ functions return the length of the token at POS, or 0. */
+
+static size_t match_real(reader_t* r) {
+    size_t i = r->pos;
+    if (i < r->length && r->s[i] == '-') i++;
+    i = reader_digits(r, i);
+    if (i >= r->length || r->s[i] != '.' || !reader_is(r, i + 1, RD)) return 0;
+    return reader_digits(r, i + 1) - r->pos;
+}
+
+static size_t match_integer(reader_t* r) {
+    size_t i = r->pos;
+    if (i < r->length && r->s[i] == '-') i++;
+    if (!reader_is(r, i, RD)) return 0;
+    return reader_digits(r, i) - r->pos;
+}
+
+static size_t match_literal(reader_t* r, const char* lit) {
+    size_t n = strlen(lit);
+    if (r->length - r->pos < n || memcmp(r->s + r->pos, lit, n) != 0) return 0;
+    return n;
+}
+
+/*
+ * Advances *I, just past a string's opening '"', over the rest of the
+ * string, skipping '\' escapes as the grammar's <string> does. Returns
+ * false if a newline or the end of input comes before the closing '"',
+ * leaving *I there.
+ */
+static bool skip_string(const unsigned char* s, size_t length, size_t* i) {
+    for (; *i < length && s[*i] != '\n' && s[*i] != '\r'; (*i)++) {
+        if (s[*i] == '"') {
+            (*i)++;
+            return true;
+        }
+        if (s[*i] == '\\' && *i + 1 < length && s[*i + 1] != '\n' && s[*i + 1] != '\r') (*i)++;
+    }
+    return false;
+}
+
+static size_t match_string(reader_t* r) {
+    if (r->s[r->pos] != '"') return 0;
+    size_t end = r->pos + 1;
+    return skip_string(r->s, r->length, &end) ? end - r->pos : 0;
+}
+
+static size_t match_symbol(reader_t* r) {
+    size_t i = r->pos;
+    while (reader_is(r, i, RS)) i++;
+    return i - r->pos;
+}
+
+/* Comments run from ';' to the end of the line and read as nothing, like the grammar's <comment>. */
+static size_t skip_blank(const unsigned char* s, size_t length, size_t i) {
+    while (i < length) {
+        if (READER_CLASS[s[i]] & RB) {
+            i++;
+        } else if (s[i] == ';') {
+            while (i < length && s[i] != '\n' && s[i] != '\r') i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static void reader_skip_blank(reader_t* r) {
+    r->pos = skip_blank(r->s, r->length, r->pos);
+}
+
+static char* reader_token(reader_t* r, size_t n) {
+    if (n + 1 > r->token_capacity) {
+        r->token_capacity = n + 1 > r->token_capacity * 2 ? n + 1 : r->token_capacity * 2;
+        r->token = realloc(r->token, r->token_capacity);
+    }
+    memcpy(r->token, r->s + r->pos, n);
+    r->token[n] = '\0';
+    return r->token;
+}
+
+/* Same translation as mpcf_unescape: known two character escapes collapse, anything else is kept. */
+static char* reader_unescape(reader_t* r, size_t n) {
+    static const char escapes[] = "abfnrtv\\'\"0";
+    static const char chars[] = "\a\b\f\n\r\t\v\\\'\"";
+
+    char* t = reader_token(r, n);
+    size_t j = 0;
+    for (size_t i=0; i < n; i++) {
+        const char* esc;
+        if (t[i] == '\\' && i + 1 < n && (esc = strchr(escapes, t[i + 1]))) {
+            if (*esc != '0') t[j++] = chars[esc - escapes];
+            i++;
+            continue;
+        }
+        t[j++] = t[i];
+    }
+    t[j] = '\0';
+    return t;
+}
+
+static lval* read_integer(reader_t* r, size_t n) {
+    errno = 0;
+    long value = strtol(reader_token(r, n), NULL, 10);
+    return errno != ERANGE ? lval_integer(value) : lval_err("Bad Integer");
+}
+
+static lval* read_real(reader_t* r, size_t n) {
+    double value = strtod(reader_token(r, n), NULL);
+    /* Only overflow is an error. strtod also sets ERANGE for subnormals, which read back exactly. */
+    return fabs(value) != HUGE_VAL ? lval_real(value) : lval_err("Bad real");
+}
+
+static void reader_push(reader_t* r, lval* x) {
+    if (r->count == r->capacity) {
+        r->capacity = r->capacity ? r->capacity * 2 : 64;
+        r->values = realloc(r->values, sizeof(lval*) * r->capacity);
+    }
+    r->values[r->count++] = x;
+}
+
+static void reader_open(reader_t* r, lval_t type, char close) {
+    if (r->depth == r->frames_capacity) {
+        r->frames_capacity = r->frames_capacity ? r->frames_capacity * 2 : 16;
+        r->frames = realloc(r->frames, sizeof(reader_frame) * r->frames_capacity);
+    }
+    r->frames[r->depth++] = (reader_frame) { type, close, r->count, r->pos };
+}
+
+/* Pops the innermost frame into a single S- or Q-Expression holding its values. */
+static lval* reader_close(reader_t* r) {
+    reader_frame* f = &r->frames[--r->depth];
+    lval* x = f->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+    x->count = r->count - f->start;
+    if (x->count) {
+        x->cell = malloc(sizeof(lval*) * x->count);
+        memcpy(x->cell, r->values + f->start, sizeof(lval*) * x->count);
+    }
+    r->count = f->start;
+    return x;
+}
+
+static lval* reader_error(reader_t* r, size_t pos, char* msg) {
+    int line = 1, col = 1;
+    for (size_t i=0; i < pos; i++) {
+        if (r->s[i] == '\n') {
+            line++;
+            col = 1;
+        } else {
+            col++;
+        }
+    }
+    return lval_err("<stdin>:%d:%d: %s", line, col, msg);
+}
+
+/*
+ * Reads every form in INPUT into an S-Expression, the same value lval_read
+ * builds from the grammar's <lispy> root. Bad numbers become error values in
+ * place, as they do there. Syntax errors are returned instead of the forms.
+ */
+lval* reader_read(const char* input, size_t length) {
+    reader_t r = { (const unsigned char*) input, length, 0 };
+    lval* err = NULL;
+
+    reader_open(&r, LVAL_SEXPR, '\0');
+    reader_skip_blank(&r);
+
+    while (r.pos < r.length) {
+        unsigned char c = r.s[r.pos];
+        size_t n;
+        lval* x = NULL;
+
+        if ((n = match_real(&r))) {
+            x = read_real(&r, n);
+        } else if ((n = match_integer(&r))) {
+            x = read_integer(&r, n);
+        } else if ((n = match_literal(&r, "true"))) {
+            x = lval_boolean(true);
+        } else if ((n = match_literal(&r, "false"))) {
+            x = lval_boolean(false);
+        } else if ((n = match_string(&r))) {
+            r.pos++;
+            x = lval_str(reader_unescape(&r, n - 2));
+            r.pos--;
+        } else if ((n = match_symbol(&r))) {
+            x = lval_sym(reader_token(&r, n));
+        } else if (c == '(' || c == '{') {
+            reader_open(&r, c == '(' ? LVAL_SEXPR : LVAL_QEXPR, c == '(' ? ')' : '}');
+            n = 1;
+        } else if ((c == ')' || c == '}') && r.depth > 1 && r.frames[r.depth - 1].close == c) {
+            x = reader_close(&r);
+            n = 1;
+        } else if (c == '"') {
+            err = reader_error(&r, r.pos, "unterminated string");
+            break;
+        } else {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "unexpected '%c'", c);
+            err = reader_error(&r, r.pos, msg);
+            break;
+        }
+
+        if (x) reader_push(&r, x);
+        r.pos += n;
+        reader_skip_blank(&r);
+    }
+
+    if (!err && r.depth > 1) {
+        reader_frame* f = &r.frames[r.depth - 1];
+        char msg[64];
+        snprintf(msg, sizeof(msg), "missing '%c' for this '%c'", f->close, f->close == ')' ? '(' : '{');
+        err = reader_error(&r, f->pos, msg);
+    }
+
+    lval* forms = NULL;
+    if (err) {
+        for (int i=0; i < r.count; i++) lval_del(r.values[i]);
+        forms = err;
+    } else {
+        forms = reader_close(&r);
+    }
+
+    free(r.values);
+    free(r.frames);
+    free(r.token);
+    return forms;
+}
+
+/*
+ * Finds the next top-level chunk of INPUT at or after *POS and advances
+ * *POS past it. A chunk starts at the first byte that is not blank or
+ * comment and runs until a ')' closes every bracket opened in it, or to
+ * the end of the input. Brackets inside strings and comments are ignored.
+ * Returns false when only blanks and comments are left.
+ */
+bool reader_next_span(const char* input, size_t length, size_t* pos, reader_span* span) {
+    const unsigned char* s = (const unsigned char*) input;
+    size_t i = skip_blank(s, length, *pos);
+    if (i >= length) {
+        *pos = length;
+        return false;
+    }
+
+    size_t start = i;
+    long depth = 0;
+    while (i < length) {
+        unsigned char c = s[i++];
+        if (c == '"') {
+            skip_string(s, length, &i);
+        } else if (c == ';') {
+            while (i < length && s[i] != '\n' && s[i] != '\r') i++;
+        } else if (c == '(' || c == '{') {
+            depth++;
+        } else if (c == '}') {
+            depth--;
+        } else if (c == ')' && --depth <= 0) {
+            break;
+        }
+    }
+
+    size_t end = i;
+    while (end > start && (READER_CLASS[s[end - 1]] & RB)) end--;
+    span->start = input + start;
+    span->length = end - start;
+    *pos = i;
+    return true;
+}
+
+void reader_stream_init(reader_stream* s) {
+    *s = (reader_stream) { NULL, 0, 0, 0, 0, 0, false, false, false };
+}
+
+void reader_stream_free(reader_stream* s) {
+    free(s->buf);
+    reader_stream_init(s);
+}
+
+/* Appends LINE and a newline. Bytes before the open chunk have been handed out already and are dropped. */
+void reader_stream_feed_line(reader_stream* s, const char* line, size_t length) {
+    size_t keep = s->open ? s->start : s->pos;
+    if (keep) {
+        memmove(s->buf, s->buf + keep, s->length - keep);
+        s->length -= keep;
+        s->pos -= keep;
+        s->start = 0;
+    }
+
+    if (s->length + length + 1 > s->capacity) {
+        s->capacity = s->length + length + 1 > s->capacity * 2 ? s->length + length + 1 : s->capacity * 2;
+        s->buf = realloc(s->buf, s->capacity);
+    }
+    memcpy(s->buf + s->length, line, length);
+    s->length += length;
+    s->buf[s->length++] = '\n';
+}
+
+static void reader_stream_span(reader_stream* s, size_t end, reader_span* span) {
+    while (end > s->start && (READER_CLASS[(unsigned char) s->buf[end - 1]] & RB)) end--;
+    span->start = s->buf + s->start;
+    span->length = end - s->start;
+    s->open = false;
+}
+
+/* Same chunking as reader_next_span, resumed from where the last call stopped. */
+bool reader_stream_next(reader_stream* s, reader_span* span) {
+    while (s->pos < s->length) {
+        unsigned char c = s->buf[s->pos];
+        if (s->in_comment) {
+            s->in_comment = c != '\n' && c != '\r';
+            s->pos++;
+            continue;
+        }
+        if (s->in_string) {
+            /* Every fed line ends in a newline, so an escape never waits on the next line. */
+            if (c == '\\' && s->buf[s->pos + 1] != '\n' && s->buf[s->pos + 1] != '\r') s->pos++;
+            else s->in_string = c != '"' && c != '\n' && c != '\r';
+            s->pos++;
+            continue;
+        }
+        if (!s->open) {
+            if (READER_CLASS[c] & RB) {
+                s->pos++;
+                continue;
+            }
+            if (c == ';') {
+                s->in_comment = true;
+                s->pos++;
+                continue;
+            }
+            s->open = true;
+            s->start = s->pos;
+            s->depth = 0;
+        }
+
+        s->pos++;
+        if (c == '"') {
+            s->in_string = true;
+        } else if (c == ';') {
+            s->in_comment = true;
+        } else if (c == '(' || c == '{') {
+            s->depth++;
+        } else if (c == '}') {
+            s->depth--;
+        } else if (c == ')' && --s->depth <= 0) {
+            reader_stream_span(s, s->pos, span);
+            return true;
+        }
+    }
+
+    if (s->open && s->depth <= 0 && !s->in_string) {
+        reader_stream_span(s, s->length, span);
+        return true;
+    }
+    return false;
+}
+
+/* True while a chunk is waiting for more lines to close it. */
+bool reader_stream_pending(reader_stream* s) {
+    return s->open;
+}
+
+/* At the end of the input, hands back whatever chunk is still open so it can be reported. */
+bool reader_stream_end(reader_stream* s, reader_span* span) {
+    if (!s->open) return false;
+    reader_stream_span(s, s->length, span);
+    s->pos = s->length;
+    s->in_string = false;
+    s->in_comment = false;
+    return true;
+}
+
+typedef struct {
+    const reader_span* spans;
+    lval** out;
+    long lo;
+    long hi;
+} reader_task;
+
+static void* reader_task_run(void* arg) {
+    reader_task* t = arg;
+    for (long i=t->lo; i < t->hi; i++) {
+        t->out[i] = reader_read(t->spans[i].start, t->spans[i].length);
+    }
+    return NULL;
+}
+
+static int reader_thread_count(size_t bytes, long count) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long wanted = bytes / (READER_PARALLEL_THRESHOLD / 2);
+    if (cpus > wanted) cpus = wanted;
+    if (cpus > count) cpus = count;
+    if (cpus > READER_MAX_THREADS) cpus = READER_MAX_THREADS;
+    return cpus < 1 ? 1 : (int) cpus;
+}
+
+/*
+ * Reads each of the COUNT SPANS into OUT at the same index, as reader_read
+ * would. Large inputs are cut into runs of neighbouring spans holding about
+ * the same number of bytes, and each run is read on its own thread.
+ */
+void reader_read_spans(const reader_span* spans, long count, lval** out) {
+    size_t bytes = 0;
+    for (long i=0; i < count; i++) bytes += spans[i].length;
+
+    int threads = bytes >= READER_PARALLEL_THRESHOLD ? reader_thread_count(bytes, count) : 1;
+    reader_task tasks[READER_MAX_THREADS];
+    long lo = 0;
+    size_t seen = 0;
+    for (int t=0; t < threads; t++) {
+        long hi = lo;
+        size_t goal = bytes / threads * (t + 1);
+        while (hi < count && (t == threads - 1 || seen < goal)) seen += spans[hi++].length;
+        tasks[t] = (reader_task) { spans, out, lo, hi };
+        lo = hi;
+    }
+
+    pthread_t ids[READER_MAX_THREADS];
+    bool started[READER_MAX_THREADS];
+    for (int t=1; t < threads; t++) {
+        started[t] = pthread_create(&ids[t], NULL, reader_task_run, &tasks[t]) == 0;
+        if (!started[t]) reader_task_run(&tasks[t]);
+    }
+    reader_task_run(&tasks[0]);
+    for (int t=1; t < threads; t++) {
+        if (started[t]) pthread_join(ids[t], NULL);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef MLISP_READER_H
+#define MLISP_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "eval.h"
+
+/*
+ * Single pass reader for the language in resources/lisp.grammar. It scans
+ * the input bytes once and builds lvals directly, without an mpc AST. Tokens
+ * are recognised in the same order as the grammar's <expr> alternatives, so
+ * both paths read any input to the same values.
+ *
+ * The reader keeps no state between calls, so reader_read_spans can read
+ * the top-level chunks of a file on several threads at once. Inputs of at
+ * least READER_PARALLEL_THRESHOLD bytes are split that way.
+ */
+
+#define READER_PARALLEL_THRESHOLD (256 * 1024)
+#define READER_MAX_THREADS 32
+
+typedef struct {
+    const char* start;
+    size_t length;
+} reader_span;
+
+/*
+ * Input that arrives a line at a time, as at the REPL. Each byte is scanned
+ * once; reader_stream_next hands back a chunk as soon as its last bracket
+ * closes, or at the end of a line when no bracket or string is left open.
+ * Spans point into the stream's buffer and last until the next feed.
+ */
+typedef struct {
+    char* buf;
+    size_t length;
+    size_t capacity;
+    size_t pos;
+    size_t start;
+    long depth;
+    bool open;
+    bool in_string;
+    bool in_comment;
+} reader_stream;
+
+lval* reader_read(const char* input, size_t length);
+bool reader_next_span(const char* input, size_t length, size_t* pos, reader_span* span);
+void reader_read_spans(const reader_span* spans, long count, lval** out);
+
+void reader_stream_init(reader_stream* s);
+void reader_stream_free(reader_stream* s);
+void reader_stream_feed_line(reader_stream* s, const char* line, size_t length);
+bool reader_stream_next(reader_stream* s, reader_span* span);
+bool reader_stream_pending(reader_stream* s);
+bool reader_stream_end(reader_stream* s, reader_span* span);
+
+#endif
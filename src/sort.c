@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "eval.h"
+#include "sort.h"
+
+#define SORT_INSERTION_LIMIT 16
+
+static bool item_less(sort_kind_t kind, sort_item* a, sort_item* b) {
+    switch (kind) {
+        case SORT_INTEGER:
+            return a->key.integer < b->key.integer;
+        case SORT_REAL:
+            return a->key.real < b->key.real;
+        case SORT_STRING:
+            return strcmp(a->key.str, b->key.str) < 0;
+    }
+    return false;
+}
+
+static void insertion_sort(sort_item* a, long n, sort_kind_t kind) {
+    for (long i=1; i < n; i++) {
+        sort_item x = a[i];
+        long j = i;
+        while (j > 0 && item_less(kind, &x, &a[j - 1])) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = x;
+    }
+}
+
+/* Stable LSD radix sort, one byte per pass. Passes where every key shares the byte are skipped. */
+static void radix_sort(sort_item* a, long n) {
+    static const uint64_t sign = 1ULL << 63;
+    long (*counts)[256] = calloc(8, sizeof(long[256]));
+
+    for (long i=0; i < n; i++) {
+        uint64_t u = (uint64_t) a[i].key.integer ^ sign;
+        for (int b=0; b < 8; b++) counts[b][(u >> (b * 8)) & 0xff]++;
+    }
+
+    sort_item* buf = malloc(sizeof(sort_item) * n);
+    sort_item* src = a;
+    sort_item* dst = buf;
+
+    for (int b=0; b < 8; b++) {
+        uint64_t first = ((uint64_t) a[0].key.integer ^ sign) >> (b * 8) & 0xff;
+        if (counts[b][first] == n) continue;
+
+        long offset = 0;
+        for (int d=0; d < 256; d++) {
+            long c = counts[b][d];
+            counts[b][d] = offset;
+            offset += c;
+        }
+        for (long i=0; i < n; i++) {
+            uint64_t u = (uint64_t) src[i].key.integer ^ sign;
+            dst[counts[b][(u >> (b * 8)) & 0xff]++] = src[i];
+        }
+
+        sort_item* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != a) memcpy(a, src, sizeof(sort_item) * n);
+    free(buf);
+    free(counts);
+}
+
+static void sift_down(sort_item* a, long root, long n) {
+    while (2 * root + 1 < n) {
+        long child = 2 * root + 1;
+        if (child + 1 < n && a[child].key.real < a[child + 1].key.real) child++;
+        if (!(a[root].key.real < a[child].key.real)) return;
+        sort_item t = a[root];
+        a[root] = a[child];
+        a[child] = t;
+        root = child;
+    }
+}
+
+static void heap_sort(sort_item* a, long n) {
+    for (long i=n / 2 - 1; i >= 0; i--) sift_down(a, i, n);
+    for (long i=n - 1; i > 0; i--) {
+        sort_item t = a[0];
+        a[0] = a[i];
+        a[i] = t;
+        sift_down(a, 0, i);
+    }
+}
+
+static void swap_items(sort_item* a, long i, long j) {
+    sort_item t = a[i];
+    a[i] = a[j];
+    a[j] = t;
+}
+
+/* Introsort on real keys. The partition loop swaps unconditionally and advances by the comparison result. */
+static void intro_sort(sort_item* a, long n, int depth) {
+    while (n > SORT_INSERTION_LIMIT) {
+        if (depth-- == 0) {
+            heap_sort(a, n);
+            return;
+        }
+
+        long mid = n / 2;
+        if (a[mid].key.real < a[0].key.real) swap_items(a, mid, 0);
+        if (a[n - 1].key.real < a[0].key.real) swap_items(a, n - 1, 0);
+        if (a[mid].key.real < a[n - 1].key.real) swap_items(a, mid, n - 1);
+
+        double pivot = a[n - 1].key.real;
+        long i = 0;
+        for (long j=0; j < n - 1; j++) {
+            sort_item t = a[j];
+            bool lt = t.key.real < pivot;
+            a[j] = a[i];
+            a[i] = t;
+            i += lt;
+        }
+        swap_items(a, i, n - 1);
+
+        if (i < n - i - 1) {
+            intro_sort(a, i, depth);
+            a += i + 1;
+            n -= i + 1;
+        } else {
+            intro_sort(a + i + 1, n - i - 1, depth);
+            n = i;
+        }
+    }
+    insertion_sort(a, n, SORT_REAL);
+}
+
+static void merge_runs(sort_item* dst, sort_item* a, long na, sort_item* b, long nb, sort_kind_t kind) {
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (item_less(kind, &b[j], &a[i])) dst[k++] = b[j++];
+        else dst[k++] = a[i++];
+    }
+    while (i < na) dst[k++] = a[i++];
+    while (j < nb) dst[k++] = b[j++];
+}
+
+static void merge_sort(sort_item* a, sort_item* buf, long n, sort_kind_t kind) {
+    if (n <= SORT_INSERTION_LIMIT) {
+        insertion_sort(a, n, kind);
+        return;
+    }
+
+    long mid = n / 2;
+    merge_sort(a, buf, mid, kind);
+    merge_sort(a + mid, buf, n - mid, kind);
+    merge_runs(buf, a, mid, a + mid, n - mid, kind);
+    memcpy(a, buf, sizeof(sort_item) * n);
+}
+
+static void sort_serial(sort_item* a, long n, sort_kind_t kind, bool stable) {
+    if (n < 2) return;
+
+    switch (kind) {
+        case SORT_INTEGER:
+            radix_sort(a, n);
+            break;
+        case SORT_REAL: {
+            if (stable) {
+                sort_item* buf = malloc(sizeof(sort_item) * n);
+                merge_sort(a, buf, n, kind);
+                free(buf);
+                break;
+            }
+
+            int depth = 0;
+            for (long m=n; m > 1; m >>= 1) depth += 2;
+            intro_sort(a, n, depth);
+            break;
+        }
+        case SORT_STRING: {
+            sort_item* buf = malloc(sizeof(sort_item) * n);
+            merge_sort(a, buf, n, kind);
+            free(buf);
+            break;
+        }
+    }
+}
+
+typedef struct {
+    sort_kind_t kind;
+    bool stable;
+    sort_item* src;
+    sort_item* dst;
+    long lo;
+    long mid;
+    long hi;
+} sort_task;
+
+static void* sort_task_run(void* arg) {
+    sort_task* t = arg;
+    if (t->dst) {
+        merge_runs(t->dst + t->lo, t->src + t->lo, t->mid - t->lo,
+                   t->src + t->mid, t->hi - t->mid, t->kind);
+    } else {
+        sort_serial(t->src + t->lo, t->hi - t->lo, t->kind, t->stable);
+    }
+    return NULL;
+}
+
+/* Runs every task, on its own thread where one can be started. */
+static void sort_tasks_run(sort_task* tasks, int count) {
+    pthread_t threads[SORT_MAX_THREADS];
+    bool started[SORT_MAX_THREADS];
+
+    for (int i=1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, sort_task_run, &tasks[i]) == 0;
+        if (!started[i]) sort_task_run(&tasks[i]);
+    }
+    sort_task_run(&tasks[0]);
+    for (int i=1; i < count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+}
+
+static int sort_thread_count(long n) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long wanted = n / (SORT_PARALLEL_THRESHOLD / 2);
+    if (cpus > wanted) cpus = wanted;
+    if (cpus > SORT_MAX_THREADS) cpus = SORT_MAX_THREADS;
+    return cpus < 1 ? 1 : (int) cpus;
+}
+
+/* Sorts each of the chunks in parallel, then merges neighbouring runs pairwise in parallel rounds. */
+static void sort_parallel(sort_item* a, long n, sort_kind_t kind, bool stable, int chunks) {
+    long bounds[SORT_MAX_THREADS + 1];
+    for (int i=0; i <= chunks; i++) bounds[i] = n * i / chunks;
+
+    sort_task tasks[SORT_MAX_THREADS];
+    for (int i=0; i < chunks; i++) {
+        tasks[i] = (sort_task) { kind, stable, a, NULL, bounds[i], bounds[i], bounds[i + 1] };
+    }
+    sort_tasks_run(tasks, chunks);
+
+    sort_item* buf = malloc(sizeof(sort_item) * n);
+    sort_item* src = a;
+    sort_item* dst = buf;
+    while (chunks > 1) {
+        int count = 0;
+        for (int i=0; i < chunks; i += 2) {
+            long hi = i + 2 <= chunks ? bounds[i + 2] : bounds[i + 1];
+            tasks[count++] = (sort_task) { kind, stable, src, dst, bounds[i], bounds[i + 1], hi };
+        }
+        sort_tasks_run(tasks, count);
+
+        for (int i=0; i < count; i++) bounds[i + 1] = tasks[i].hi;
+        chunks = count;
+
+        sort_item* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != a) memcpy(a, src, sizeof(sort_item) * n);
+    free(buf);
+}
+
+/* STABLE keeps items with equal keys in input order; integers and strings always do. */
+void sort_items(sort_item* items, long n, sort_kind_t kind, bool stable) {
+    int threads = n >= SORT_PARALLEL_THRESHOLD ? sort_thread_count(n) : 1;
+    if (threads > 1) sort_parallel(items, n, kind, stable, threads);
+    else sort_serial(items, n, kind, stable);
+}
+
+/*
+ * Stable merge sort of CELLS ordered by the user predicate CMP, which is
+ * called as (CMP a b) and should be true when a sorts before b. Returns NULL,
+ * or the first error CMP raised. CELLS is a permutation of its input either way.
+ */
+lval* sort_with(lenv* e, lval* cmp, lval** cells, long n) {
+    lval** buf = malloc(sizeof(lval*) * (n ? n : 1));
+    lval** src = cells;
+    lval** dst = buf;
+    lval* err = NULL;
+
+    for (long width=1; width < n; width *= 2) {
+        for (long lo=0; lo < n; lo += 2 * width) {
+            long mid = lo + width < n ? lo + width : n;
+            long hi = lo + 2 * width < n ? lo + 2 * width : n;
+            long i = lo, j = mid, k = lo;
+
+            while (!err && i < mid && j < hi) {
+                lval* args = lval_sexpr();
+                lval_add(args, lval_copy(src[j]));
+                lval_add(args, lval_copy(src[i]));
+                lval* less = lval_apply(e, cmp, args);
+                if (less->type == LVAL_ERR) {
+                    err = less;
+                    break;
+                }
+                dst[k++] = to_bool(less) ? src[j++] : src[i++];
+                lval_del(less);
+            }
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+
+        lval** t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != cells) memcpy(cells, src, sizeof(lval*) * n);
+    free(buf);
+    return err;
+}
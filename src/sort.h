@@ -0,0 +1,32 @@
+#ifndef MLISP_SORT_H
+#define MLISP_SORT_H
+
+#include <stdbool.h>
+
+#include "eval.h"
+
+/*
+ * Sorting works on an array of (key, value) items so that the hot loops
+ * compare unboxed keys. Integers use an LSD radix sort, reals an introsort,
+ * strings a merge sort. Inputs of at least SORT_PARALLEL_THRESHOLD items are
+ * split across threads and merged back in parallel.
+ */
+
+#define SORT_PARALLEL_THRESHOLD 65536
+#define SORT_MAX_THREADS 16
+
+typedef enum { SORT_INTEGER, SORT_REAL, SORT_STRING } sort_kind_t;
+
+typedef struct {
+    union {
+        long integer;
+        double real;
+        char* str;
+    } key;
+    lval* v;
+} sort_item;
+
+void sort_items(sort_item* items, long n, sort_kind_t kind, bool stable);
+lval* sort_with(lenv* e, lval* cmp, lval** cells, long n);
+
+#endif
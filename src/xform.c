@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "eval.h"
+#include "lseq.h"
+#include "xform.h"
+
+lxform* xform_alloc(int count) {
+    lxform* xf = malloc(sizeof(lxform));
+    xf->refs = 1;
+    xf->count = count;
+    xf->stages = malloc(sizeof(xform_stage) * (count ? count : 1));
+    return xf;
+}
+
+lxform* xform_new(xform_kind_t kind, lval* fn, long n) {
+    lxform* xf = xform_alloc(1);
+    xf->stages[0].kind = kind;
+    xf->stages[0].fn = fn;
+    xf->stages[0].n = n;
+    return xf;
+}
+
+/* Stages run in argument order, so (comp (map f) (filter p)) maps first. */
+lxform* xform_comp(lxform** xfs, int count) {
+    int total = 0;
+    for (int i=0; i < count; i++) total += xfs[i]->count;
+
+    lxform* xf = xform_alloc(total);
+    int k = 0;
+    for (int i=0; i < count; i++) {
+        for (int j=0; j < xfs[i]->count; j++) {
+            xform_stage* stage = &xfs[i]->stages[j];
+            xf->stages[k].kind = stage->kind;
+            xf->stages[k].fn = stage->fn ? lval_copy(stage->fn) : NULL;
+            xf->stages[k].n = stage->n;
+            k++;
+        }
+    }
+    return xf;
+}
+
+lxform* xform_ref(lxform* xf) {
+    xf->refs++;
+    return xf;
+}
+
+void xform_unref(lxform* xf) {
+    if (--xf->refs > 0) return;
+
+    for (int i=0; i < xf->count; i++) {
+        if (xf->stages[i].fn) lval_del(xf->stages[i].fn);
+    }
+    free(xf->stages);
+    free(xf);
+}
+
+/*
+ * Pushes X through the stages of XF. Returns the transformed value, NULL
+ * if a stage dropped it, or an error. Sets *STOP once a take stage is full.
+ */
+static lval* xform_step(lenv* e, lxform* xf, long* counters, lval* x, bool* stop) {
+    for (int i=0; i < xf->count && x; i++) {
+        xform_stage* stage = &xf->stages[i];
+        lval* keep;
+        switch (stage->kind) {
+            case XFORM_MAP:
+                x = lval_apply(e, stage->fn, lval_add(lval_sexpr(), x));
+                if (x->type == LVAL_ERR) return x;
+                break;
+            case XFORM_FILTER:
+                keep = lval_apply(e, stage->fn, lval_add(lval_sexpr(), lval_copy(x)));
+                if (keep->type == LVAL_ERR) {
+                    lval_del(x);
+                    return keep;
+                }
+                if (!to_bool(keep)) {
+                    lval_del(x);
+                    x = NULL;
+                }
+                lval_del(keep);
+                break;
+            case XFORM_TAKE:
+                if (--counters[i] <= 0) *stop = true;
+                break;
+            case XFORM_DROP:
+                if (counters[i] > 0) {
+                    counters[i]--;
+                    lval_del(x);
+                    x = NULL;
+                }
+                break;
+        }
+    }
+    return x;
+}
+
+/*
+ * Reduces COLL (a Q-Expression or a lazy sequence, consumed) through XF into
+ * INIT with RF. A NULL RF appends each result to INIT, which must then be a
+ * Q-Expression.
+ */
+lval* xform_transduce(lenv* e, lxform* xf, lval* rf, lval* init, lval* coll) {
+    long* counters = malloc(sizeof(long) * (xf->count ? xf->count : 1));
+    bool stop = false;
+    for (int i=0; i < xf->count; i++) {
+        counters[i] = xf->stages[i].n;
+        if (xf->stages[i].kind == XFORM_TAKE && counters[i] <= 0) stop = true;
+    }
+
+    lseq_iter* it = NULL;
+    int index = 0;
+    if (coll->type == LVAL_SEQ) it = lseq_iter_new(e, coll->seq);
+
+    lval* acc = init;
+    while (!stop) {
+        lval* x;
+        if (it) {
+            if (!(x = lseq_iter_next(it))) break;
+        } else {
+            if (index == coll->count) break;
+            x = coll->cell[index];
+            coll->cell[index++] = NULL;
+        }
+
+        if (x->type != LVAL_ERR) x = xform_step(e, xf, counters, x, &stop);
+        if (!x) continue;
+        if (x->type == LVAL_ERR) {
+            lval_del(acc);
+            acc = x;
+            break;
+        }
+
+        if (!rf) {
+            acc = lval_add(acc, x);
+            continue;
+        }
+
+        lval* args = lval_sexpr();
+        lval_add(args, acc);
+        lval_add(args, x);
+        acc = lval_apply(e, rf, args);
+        if (acc->type == LVAL_ERR) break;
+    }
+
+    if (it) {
+        lseq_iter_del(it);
+    } else {
+        coll->count -= index;
+        memmove(&coll->cell[0], &coll->cell[index], sizeof(lval*) * coll->count);
+    }
+    lval_del(coll);
+    free(counters);
+    return acc;
+}
@@ -0,0 +1,34 @@
+#ifndef MLISP_XFORM_H
+#define MLISP_XFORM_H
+
+#include "eval.h"
+
+/*
+ * A transducer is an immutable, reference counted list of stages. Running
+ * one pushes each element of a collection through every stage and into the
+ * reducing function in a single loop, without building intermediate lists.
+ */
+
+typedef enum { XFORM_MAP, XFORM_FILTER, XFORM_TAKE, XFORM_DROP } xform_kind_t;
+
+typedef struct {
+    xform_kind_t kind;
+    lval* fn;
+    long n;
+} xform_stage;
+
+struct lxform {
+    int refs;
+    int count;
+    xform_stage* stages;
+};
+
+lxform* xform_alloc(int count);
+lxform* xform_new(xform_kind_t kind, lval* fn, long n);
+lxform* xform_comp(lxform** xfs, int count);
+lxform* xform_ref(lxform* xf);
+void xform_unref(lxform* xf);
+
+lval* xform_transduce(lenv* e, lxform* xf, lval* rf, lval* init, lval* coll);
+
+#endif
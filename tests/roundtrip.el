@@ -0,0 +1,12 @@
+; Reals that `make test` prints, reads back from the printed text and prints
+; again. Both prints must agree, so each real reads back to the same double.
+
+(println (list
+    0.0 -0.0 0.1 0.3 -2.5 (/ 1.0 3.0) 100.0 123456789.125
+    (^ 2.0 -1074)
+    (- 0.0 (^ 2.0 -1074))
+    (* 3.0 (^ 2.0 -1074))
+    (^ 2.0 -1022)
+    (- (^ 2.0 -1022) (^ 2.0 -1074))
+    (^ 2.0 1023)
+    (* (- 2.0 (^ 2.0 -52)) (^ 2.0 1023))))